@@ -1,49 +1,128 @@
 #include "./node.hpp"
+#include "./linear_activation_node.hpp"
 #include "utils.hpp"
 
 #ifndef INCLUDE_ACTIVATION_NODE
 #define INCLUDE_ACTIVATION_NODE
 
-template <typename ActivationPolicy>
-requires Callable <ActivationPolicy, Eigen::VectorXd>
-class Activation : public Node
+/**
+ * @brief Activation node
+ * 
+ * @tparam ActivationPolicy implements the element-wise function
+ * @tparam P specifies the numeric types. By default it follows the scalar
+ *         type of the policy, e.g. `TanhTemplate<Eigen::MatrixXf>` gives a
+ *         single-precision node. For mixed precision it must be given
+ *         explicitly.
+ */
+template <typename ActivationPolicy, typename P = Precision<typename ActivationPolicy::Scalar>>
+requires Callable <ActivationPolicy, typename P::Matrix>
+class Activation : public NodeTemplate<P>
 { 
   public:
+    using Base = NodeTemplate<P>;
+    using typename Base::VecDep;
+    using typename Base::LocalJacobian;
+    using typename Base::Matrix;
+    using typename Base::GradMatrix;
+
     Activation(VecDep&& dependencies, 
                std::string&& Id,
                const ActivationPolicy& act_policy = ActivationPolicy())
-    : act_policy_(act_policy),
-      Node(std::forward<VecDep>(dependencies), std::forward<std::string>(Id))
+    : Base(std::forward<VecDep>(dependencies), std::forward<std::string>(Id)),
+      act_policy_(act_policy)
     { 
       outSize_ = inSize_ = dependencies_[0]->GetOutSize();
     }
 
     ~Activation() {}
+
+    virtual Base* clone(VecDep&& dependencies) const override
+    {
+      return new Activation(std::move(dependencies), std::string(Id_), act_policy_);
+    }
     
     virtual void forward() override
     {
-      auto input = dependencies_[0]->GetValue();
-      value_ =  act_policy_(input); 
+      const auto& input = dependencies_[0]->GetValue();
+      // If possible the derivative is computed together with the value, and
+      // it is cached for the backward pass
+      if constexpr (FusedDerivative<ActivationPolicy, Matrix>)
+        act_policy_.EvaluateAndDerive(input, value_, derivative_);
+      else
+        value_ =  act_policy_(input); 
+    }
+
+    // Supported by policies with a const `Evaluate(input, output)`
+    virtual bool evaluate(const Matrix& input, Matrix& output) const override
+    {
+      if constexpr (InPlaceEvaluation<ActivationPolicy, Matrix>) {
+        act_policy_.Evaluate(input, output);
+        return true;
+      }
+      else
+        return false;
     }
 
 
     virtual void dependency_rule() override {}
 
-    virtual void gradient(Eigen::Block<Eigen::MatrixXd,-1,-1>&& g) override {}
+    // An activation applied to a plain linear layer can be fused with it
+    // (see `LinearActivationTemplate`)
+    virtual Base* fuse() const override
+    {
+      const auto* linear = dynamic_cast<const LinearTemplate<P>*>(dependencies_[0]);
+      if (!linear || typeid(*linear) != typeid(LinearTemplate<P>))
+        return nullptr;
+      return new LinearActivationTemplate<ActivationPolicy, P>(*linear, linear->GetDependencies(), std::string(Id_), act_policy_);
+    }
 
-    virtual void backward() override 
+    virtual void gradient(Eigen::Ref<GradMatrix> g) override {}
+
+    // Only the diagonal of the Jacobian is stored, one column per sample.
+    // The buffer is a member of the class, and it is allocated only once.
+    virtual LocalJacobian local_jacobian() override
     {
-      Eigen::MatrixXd TemporaryMat (outSize_, outSize_);
-      TemporaryMat.diagonal() = act_policy_.Derive(dependencies_[0]->GetValue());
-      auto test = dependencies_[0]->GetGradient()  + gradient_ * TemporaryMat;
-      dependencies_[0]->SetGradient(dependencies_[0]->GetGradient()  + gradient_ * TemporaryMat);
+      if constexpr (activation_structure<ActivationPolicy>() == JacobianStructure::Identity)
+        return {JacobianStructure::Identity};
+      else {
+        if constexpr (!FusedDerivative<ActivationPolicy, Matrix>)
+          act_policy_.Derive(dependencies_[0]->GetValue(), derivative_);
+        return {JacobianStructure::Diagonal, {derivative_.data(), derivative_.rows(), derivative_.cols()}};
+      }
+    }
+
+    // Estimated work of the passes, see `Node::cost`. The function is
+    // counted as one flop per element.
+    virtual Cost cost(Pass pass) const override
+    {
+      using Scalar = typename P::Scalar;
+      using GradScalar = typename P::GradScalar;
+      const double n = value_.size(), gradient = this->gradient_.size();
+      constexpr bool fused = FusedDerivative<ActivationPolicy, Matrix>;
+      constexpr bool identity = activation_structure<ActivationPolicy>() == JacobianStructure::Identity;
+      switch (pass) {
+        case Pass::Forward:
+          return {fused ? 2 * n : n, sizeof(Scalar) * (fused ? 3 * n : 2 * n)};
+        case Pass::Backward:
+          return {identity ? gradient : 2 * gradient, sizeof(GradScalar) * 2 * gradient + (identity ? 0 : sizeof(Scalar) * n)};
+        case Pass::Gradient:
+          return {};
+      }
+      return {};
     }
 
     void initialise_gradients(size_t row)
     { 
-      SetGradient(Eigen::MatrixXd::Zero(row, outSize_));
+      this->SetGradient(GradMatrix::Zero(row, outSize_));
     }
   private:
+    using Base::value_;
+    using Base::outSize_;
+    using Base::inSize_;
+    using Base::dependencies_;
+    using Base::Id_;
+
     ActivationPolicy act_policy_;
+    Matrix derivative_;
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "./precision.hpp"
+#include <cmath>
+
+#ifndef INCLUDE_ADAM
+#define INCLUDE_ADAM
+
+/**
+ * @brief Adam optimizer
+ * 
+ * @details Same interface as `SGD`. The bias corrections of the moments are
+ *          folded into the step size and into epsilon once per step (see
+ *          `begin_step`), so `update` is a single element-wise sweep over
+ *          the range.
+ */
+template <typename P = DoublePrecision>
+class AdamTemplate
+{
+  public:
+    using PrecisionType = P;
+    using Vector = typename P::Vector;
+    using GradScalar = typename P::GradScalar;
+    using GradVector = typename P::GradVector;
+
+    AdamTemplate(GradScalar learning_rate = 1e-3,
+                 GradScalar beta1 = 0.9,
+                 GradScalar beta2 = 0.999,
+                 GradScalar epsilon = 1e-8)
+    : learning_rate_(learning_rate),
+      beta1_(beta1),
+      beta2_(beta2),
+      epsilon_(epsilon)
+    {}
+
+    void initialise(size_t npar)
+    {
+      m_.setZero(npar);
+      v_.setZero(npar);
+      t_ = 0;
+    }
+
+    void begin_step()
+    {
+      t_++;
+      const GradScalar c1 = 1 - std::pow(beta1_, t_);
+      const GradScalar c2 = std::sqrt(1 - std::pow(beta2_, t_));
+      alpha_ = learning_rate_ * c2 / c1;
+      epsilon_hat_ = epsilon_ * c2;
+    }
+
+    void update(Eigen::Map<Vector> parameters, Eigen::Map<GradVector> gradients, size_t begin, size_t end)
+    {
+      const size_t n = end - begin;
+      const auto g = gradients.segment(begin, n).array();
+      auto m = m_.segment(begin, n).array();
+      auto v = v_.segment(begin, n).array();
+      m = beta1_ * m + (1 - beta1_) * g;
+      v = beta2_ * v + (1 - beta2_) * g.square();
+      parameters.segment(begin, n).array() -= (alpha_ * m / (v.sqrt() + epsilon_hat_)).template cast<typename P::Scalar>();
+    }
+
+    GradScalar GetLearningRate() const { return learning_rate_; }
+    void SetLearningRate(GradScalar learning_rate) { learning_rate_ = learning_rate; }
+
+  private:
+    GradScalar learning_rate_;
+    GradScalar beta1_;
+    GradScalar beta2_;
+    GradScalar epsilon_;
+    GradScalar alpha_ = 0;
+    GradScalar epsilon_hat_ = 0;
+    GradVector m_;
+    GradVector v_;
+    size_t t_ = 0;
+};
+using Adam = AdamTemplate<>;
+#endif
@@ -7,68 +7,36 @@ int main()
   auto console = spdlog::stdout_color_mt("App");
   Eigen::VectorXd x {{3.0, 1.0, 24.}};
 
-  //Node::NodePtr input = new Input(3);
-  //input->setValues(std::move(x));
-  Input input(3);
-  input.setValues(std::move(x));
-  
+  Graph graph;
+  auto input = graph.add(new Input(3));
+  input->setValues(std::move(x));
 
   std::mt19937 generator(10);
   auto parameters = std::make_tuple(0.0,1.0);
-  std::unique_ptr<Node> layer1 (new Linear(10, {&input}, "layer 1"));
-  std::unique_ptr<Node> layer1_act (new Activation<Tanh>({layer1.get()}, "activation layer 1"));
-  std::unique_ptr<Node> layer2 (new Linear(10, {layer1_act.get()}, "layer 2"));
-  std::unique_ptr<Node> layer2_act (new Activation<Tanh>({layer2.get()}, "activation layer 2"));
-  std::unique_ptr<Node> layer3 (new Linear(10, {layer2_act.get()}, "layer 3"));
-
-  // TODO: Get rid of this static_cast. This can be done by using CRTP fo instance
-  // I hate this static cast. The problem is that the base class does not
-  // know anything about the derived class
-  static_cast<Linear*> (layer1.get())->initialise( layer3->GetOutSize(), &generator, parameters, false);
-  static_cast<Linear*> (layer2.get())->initialise( layer3->GetOutSize(), &generator, parameters, false);
-  static_cast<Linear*> (layer3.get())->initialise( layer3->GetOutSize(), &generator, parameters, false);
-  static_cast<Activation<Tanh>*> (layer1_act.get())->initialise_gradients( layer3->GetOutSize());
-  static_cast<Activation<Tanh>*> (layer2_act.get())->initialise_gradients( layer3->GetOutSize());
-  spdlog::info("Sono qui");
-  input.initialise(layer3->GetOutSize(), false);
+  auto layer1 = graph.add(new Linear(10, {input}, "layer 1"));
+  auto layer1_act = graph.add(new Activation<Tanh>({layer1}, "activation layer 1"));
+  auto layer2 = graph.add(new Linear(10, {layer1_act}, "layer 2"));
+  auto layer2_act = graph.add(new Activation<Tanh>({layer2}, "activation layer 2"));
+  auto layer3 = graph.add(new Linear(10, {layer2_act}, "layer 3"));
+  graph.compile(layer3);
+
+  // The graph keeps the type of the nodes, so no static_cast is needed here
+  layer1->initialise( layer3->GetOutSize(), &generator, parameters, false);
+  layer2->initialise( layer3->GetOutSize(), &generator, parameters, false);
+  layer3->initialise( layer3->GetOutSize(), &generator, parameters, false);
 
   spdlog::info("Performing forward pass...");
-  layer3->forward();
+  graph.forward();
   spdlog::info("Printing the output:");
-  std::cout << layer3->GetValue() << std::endl;
-
+  std::cout << graph.GetOutput() << std::endl;
 
   spdlog::info("Starting backward process");
-  // Initialise gradient matrix
-  layer3->SetGradient(Eigen::MatrixXd::Identity(layer3->GetOutSize(), layer3->GetOutSize()));
-  layer3->backward();
-  layer2_act->backward();
-  layer2->backward();
-  layer1_act->backward();
-  layer1->backward();
+  graph.backward();
 
-  spdlog::info("Now I initialise the gradient");
-  // Collecting the total number of parameters
-  // TODO This part must be revisited. First, the network also
-  // has activation nodes. Second, I want to implement the possibility
-  // to `freeze` the layer, and thus the MLP must be aware of that.
-  size_t Npar = 0;
-  Npar += static_cast<Linear*> (layer1.get())->getParNumber();
-  Npar += static_cast<Linear*> (layer2.get())->getParNumber();
-  Npar += static_cast<Linear*> (layer3.get())->getParNumber();
-  Eigen::MatrixXd J = Eigen::MatrixXd::Zero(layer3->GetOutSize(), Npar);
-  layer3->gradient(J.block(0, 
-                           Npar - static_cast<Linear*> (layer3.get())->getParNumber(),
-                           layer3->GetOutSize(), 
-                           static_cast<Linear*> (layer3.get())->getParNumber()));
-  layer2->gradient(J.block(0, 
-                           Npar - static_cast<Linear*> (layer3.get())->getParNumber() - static_cast<Linear*> (layer2.get())->getParNumber(),
-                           layer3->GetOutSize(), 
-                           static_cast<Linear*> (layer2.get())->getParNumber()));
-  layer1->gradient(J.block(0, 
-                           Npar - static_cast<Linear*> (layer3.get())->getParNumber() - static_cast<Linear*> (layer2.get())->getParNumber() - static_cast<Linear*> (layer1.get())->getParNumber(),
-                           layer3->GetOutSize(), 
-                           static_cast<Linear*> (layer1.get())->getParNumber()));
+  // TODO I want to implement the possibility to `freeze` the layer, 
+  // and thus the graph must be aware of that.
+  spdlog::info("Now I compute the Jacobian");
+  const Eigen::MatrixXd& J = graph.jacobian();
   std::cout << J << std::endl;
 
 
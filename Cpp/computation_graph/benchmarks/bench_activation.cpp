@@ -0,0 +1,65 @@
+#include "nodes.hpp"
+#include <chrono>
+#include <iostream>
+
+/**
+ * Micro-benchmark of the element-wise evaluation of tanh and its derivative.
+ *
+ * `EigenPolicy` passes every element through a `std::function`, while
+ * `EigenArrayPolicy` evaluates whole arrays with Eigen's vectorised kernels.
+ * The last columns compare the fused evaluation of value and derivative with
+ * two separate passes (both vectorised). Matrices with fewer than
+ * `TanhTemplate::vectorisation_threshold` elements use `std::tanh` with both
+ * policies.
+ */
+
+using Clock = std::chrono::steady_clock;
+using ScalarTanh = TanhTemplate<Eigen::MatrixXd, EigenPolicy>;
+using VectorisedTanh = TanhTemplate<Eigen::MatrixXd, EigenArrayPolicy>;
+
+template <typename Func>
+double elements_per_second(Func&& f, Eigen::Index elements)
+{
+  f(); // warm-up
+  const int repetitions = std::max<int>(10, 5e7 / elements);
+  auto start = Clock::now();
+  for (int i = 0; i < repetitions; i++)
+    f();
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  return repetitions * elements / elapsed.count();
+}
+
+int main()
+{
+  ScalarTanh scalar;
+  VectorisedTanh vectorised;
+
+  std::cout << "rows\tcols\tscalar_eval[el/s]\tvector_eval[el/s]\tspeed-up\t"
+            << "scalar_derive[el/s]\tvector_derive[el/s]\tspeed-up\tmax|diff|\t"
+            << "separate[el/s]\tfused[el/s]\tspeed-up" << std::endl;
+  for (Eigen::Index rows : {4, 16, 256, 4096}) {
+    for (Eigen::Index cols : {1, 64, 256}) {
+      const Eigen::MatrixXd x = 4 * Eigen::MatrixXd::Random(rows, cols);
+      Eigen::MatrixXd out_scalar(rows, cols), out_vectorised(rows, cols), derivative(rows, cols);
+
+      double s_eval = elements_per_second([&]() { out_scalar = scalar(x); }, x.size());
+      double v_eval = elements_per_second([&]() { out_vectorised = vectorised(x); }, x.size());
+      double diff = (out_scalar - out_vectorised).cwiseAbs().maxCoeff();
+
+      double s_der = elements_per_second([&]() { scalar.Derive(x, out_scalar); }, x.size());
+      double v_der = elements_per_second([&]() { vectorised.Derive(x, out_vectorised); }, x.size());
+      diff = std::max(diff, (out_scalar - out_vectorised).cwiseAbs().maxCoeff());
+
+      double separate = elements_per_second([&]() { out_vectorised = vectorised(x); 
+                                                    vectorised.Derive(x, derivative); }, x.size());
+      double fused = elements_per_second([&]() { vectorised.EvaluateAndDerive(x, out_vectorised, derivative); }, x.size());
+
+      std::cout << rows << "\t" << cols << "\t"
+                << s_eval << "\t" << v_eval << "\t" << v_eval / s_eval << "\t"
+                << s_der << "\t" << v_der << "\t" << v_der / s_der << "\t"
+                << diff << "\t"
+                << separate << "\t" << fused << "\t" << fused / separate << std::endl;
+    }
+  }
+  return 0;
+}
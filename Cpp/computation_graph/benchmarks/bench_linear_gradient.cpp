@@ -0,0 +1,79 @@
+#include "nodes.hpp"
+#include <chrono>
+#include <iostream>
+
+/**
+ * Benchmark of the parameter Jacobian of a Linear node.
+ *
+ * The legacy path materialises the auxiliary matrix `Grad_ = [I | I ⊗ x^T]`
+ * of size `out x out*(in+1)` with `makeRecursive`, and then multiplies it
+ * densely with the gradient. The current path (`Linear::gradient`) writes the
+ * outer products directly into the Jacobian.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+// The old implementation of `Linear::gradient`, for a single sample
+void legacy_gradient(const Eigen::MatrixXd& gradient,
+                     const Eigen::VectorXd& input,
+                     Eigen::MatrixXd& Grad,
+                     Eigen::Ref<Eigen::MatrixXd> g)
+{
+  const Eigen::Index out = gradient.cols();
+  const Eigen::Index in = input.size();
+  Grad.block(0, out, out, out * in) = makeRecursive(input, out, out * in);
+  g = gradient * Grad;
+}
+
+template <typename Func>
+double time_ns(Func&& f, int repetitions)
+{
+  f(); // warm-up
+  auto start = Clock::now();
+  for (int i = 0; i < repetitions; i++)
+    f();
+  std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+  return elapsed.count() / repetitions;
+}
+
+int main()
+{
+  spdlog::set_level(spdlog::level::warn);
+  std::mt19937 generator(10);
+
+  // {input size, output size, rows of the gradient}
+  const std::vector<std::array<size_t, 3>> sizes {{3, 2, 1}, {10, 10, 10}, {50, 50, 10},
+                                                   {100, 100, 10}, {128, 128, 1}};
+
+  std::cout << "in\tout\tnout\tlegacy[ns]\tkronecker[ns]\tspeed-up\tlegacy[MB]\tkronecker[MB]\tmax|diff|" << std::endl;
+  for (const auto& [in, out, nout] : sizes) {
+    Graph graph;
+    auto input = graph.add(new Input(size_t(in)));
+    auto layer = graph.add(new Linear(size_t(out), {input}, "layer"));
+    graph.compile(layer);
+    layer->initialise_parameters(&generator, std::make_tuple(0.0, 1.0));
+    graph.setInput(Eigen::MatrixXd::Random(in, 1));
+    graph.forward();
+
+    // A random gradient with `nout` rows, as if coming from the next layers
+    layer->SetGradient(Eigen::MatrixXd::Random(nout, out));
+    const Eigen::VectorXd x = input->GetValue().col(0);
+
+    Eigen::MatrixXd Grad = Eigen::MatrixXd::Zero(out, out * (in + 1));
+    Grad.block(0, 0, out, out) = Eigen::MatrixXd::Identity(out, out);
+    Eigen::MatrixXd J_legacy(nout, layer->getParNumber());
+    Eigen::MatrixXd J_kronecker(nout, layer->getParNumber());
+
+    const int repetitions = std::max<int>(10, 2e7 / (nout * out * out * (in + 1)));
+    double t_legacy = time_ns([&]() { legacy_gradient(layer->GetGradient(), x, Grad, J_legacy); }, repetitions);
+    double t_kronecker = time_ns([&]() { layer->gradient(J_kronecker); }, repetitions);
+
+    const double MB = 1024. * 1024.;
+    std::cout << in << "\t" << out << "\t" << nout << "\t"
+              << t_legacy << "\t" << t_kronecker << "\t" << t_legacy / t_kronecker << "\t"
+              << (Grad.size() + J_legacy.size()) * sizeof(double) / MB << "\t"
+              << J_kronecker.size() * sizeof(double) / MB << "\t"
+              << (J_legacy - J_kronecker).cwiseAbs().maxCoeff() << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,92 @@
+#include "nodes.hpp"
+#include "static_mlp.hpp"
+#include <chrono>
+#include <iostream>
+
+/**
+ * Benchmark of the fixed-architecture MLP against the dynamic graph with the
+ * same architecture and parameters.
+ *
+ * For each architecture the time per sample of a forward pass, and of a
+ * forward pass followed by the Jacobian with respect to the parameters, is
+ * printed for both implementations, together with the largest difference
+ * between their results. The program returns a non-zero value if the
+ * difference, relative to the largest entry, exceeds `StaticMLP::tolerance`.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+template <typename Func>
+double time_ns(Func&& f, int repetitions)
+{
+  f(); // warm-up
+  auto start = Clock::now();
+  for (int i = 0; i < repetitions; i++)
+    f();
+  std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+  return elapsed.count() / repetitions;
+}
+
+// Builds the dynamic graph with the same architecture and parameters as `mlp`
+template <typename MLP, size_t... Is>
+void build_graph(Graph& graph, const MLP& mlp, std::index_sequence<Is...>)
+{
+  Node* last = graph.add(new Input(size_t(MLP::input_size)));
+  auto add_layer = [&]<size_t I>(std::integral_constant<size_t, I>) {
+    auto layer = graph.add(new Linear(size_t(MLP::architecture[I + 1]), {last}, "layer " + std::to_string(I + 1)));
+    layer->setWeights(mlp.template GetWeights<I>());
+    layer->setBiases(mlp.template GetBiases<I>());
+    last = graph.add(new Activation<Tanh>({layer}, "activation layer " + std::to_string(I + 1)));
+  };
+  (add_layer(std::integral_constant<size_t, Is>{}), ...);
+  graph.compile(last);
+}
+
+template <int... Sizes>
+bool run(std::mt19937& generator)
+{
+  using MLP = StaticMLP<Sizes...>;
+  MLP mlp;
+  mlp.initialise_parameters(&generator);
+
+  Graph graph;
+  build_graph(graph, mlp, std::make_index_sequence<MLP::number_of_layers>{});
+
+  const typename MLP::Input x = MLP::Input::Random();
+  const int repetitions = std::max(1000, int(2e7 / (MLP::number_of_parameters * MLP::output_size)));
+
+  double t_dynamic = time_ns([&]() { graph.setInput(Eigen::MatrixXd(x)); graph.forward(); }, repetitions);
+  double t_static = time_ns([&]() { mlp.Evaluate(x); }, repetitions);
+  double diff = (graph.GetOutput() - mlp.GetOutput()).cwiseAbs().maxCoeff();
+
+  double t_dynamic_jac = time_ns([&]() { graph.GetInputNode()->CopyValues(x);
+                                         graph.forward();
+                                         graph.backward();
+                                         graph.jacobian(); }, repetitions);
+  double t_static_jac = time_ns([&]() { mlp.Evaluate(x); mlp.jacobian(); }, repetitions);
+  diff = std::max(diff, (graph.jacobian() - mlp.jacobian()).cwiseAbs().maxCoeff());
+  const double scale = std::max({1., graph.GetOutput().cwiseAbs().maxCoeff(), graph.jacobian().cwiseAbs().maxCoeff()});
+  const bool ok = diff <= MLP::tolerance * scale;
+
+  std::string arch;
+  for (int size : MLP::architecture)
+    arch += (arch.empty() ? "" : "-") + std::to_string(size);
+  std::cout << arch << "\t" << MLP::number_of_parameters << "\t"
+            << t_dynamic << "\t" << t_static << "\t" << t_dynamic / t_static << "\t"
+            << t_dynamic_jac << "\t" << t_static_jac << "\t" << t_dynamic_jac / t_static_jac << "\t"
+            << diff << "\t" << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+int main()
+{
+  spdlog::set_level(spdlog::level::warn);
+  std::mt19937 generator(10);
+
+  std::cout << "arch\tnpar\tdynamic_fwd[ns]\tstatic_fwd[ns]\tspeed-up\t"
+            << "dynamic_jac[ns]\tstatic_jac[ns]\tspeed-up\tmax|diff|\tcheck" << std::endl;
+  bool ok = run<3, 2, 2, 1>(generator);
+  ok &= run<3, 10, 10, 1>(generator);
+  ok &= run<2, 25, 20, 8>(generator);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,168 @@
+#include "nodes.hpp"
+#include <NNAD/FeedForwardNN.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+/**
+ * Benchmark suite of the computation graph against NNAD.
+ *
+ * For a grid of architectures (tanh on every layer, as in `test_NNAD.cpp`)
+ * the graph is loaded with the parameters of an `nnad::FeedForwardNN`, and
+ * the following operations are timed:
+ *   - forward:  forward pass of a single sample
+ *   - backward: forward and backward pass of a single sample
+ *   - jacobian: forward, backward and parameter Jacobian of a single sample
+ *   - batch:    forward pass of a batch of samples
+ *   - nnad_evaluate, nnad_derive: the NNAD counterparts
+ *
+ * For each operation the time per sample, the number of heap allocations
+ * per call and the speed-up over NNAD (`Evaluate` for forward and batch,
+ * `Derive` for jacobian) are printed as a table. If a file name is given as
+ * argument, the same results are written there in JSON, to track them over
+ * time.
+ *
+ * Allocations are counted by interposing `malloc`, which is only done with
+ * glibc; elsewhere they are reported as -1.
+ */
+
+static std::atomic<long> allocations {0};
+
+#if defined(__GLIBC__)
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* malloc(size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+constexpr bool counting_allocations = true;
+#else
+constexpr bool counting_allocations = false;
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+struct Measurement {
+  std::string architecture;
+  size_t parameters;
+  std::string operation;
+  double ns_per_sample;
+  double allocations_per_call;
+  double speedup; // over NNAD, 0 if not applicable
+};
+
+/**
+ * @brief Times `f`, which processes `samples` samples per call
+ *
+ * @details The number of repetitions is chosen so that each measurement
+ *          takes about `budget` seconds.
+ */
+template <typename Func>
+std::pair<double, double> measure(Func&& f, size_t samples, double budget = 0.05)
+{
+  f(); // warm-up, which also allocates the buffers
+  auto start = Clock::now();
+  f();
+  const double once = std::chrono::duration<double>(Clock::now() - start).count();
+  const long repetitions = std::max<long>(3, budget / std::max(once, 1e-9));
+
+  const long before = allocations.load();
+  start = Clock::now();
+  for (long i = 0; i < repetitions; i++)
+    f();
+  const double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  const double allocs = counting_allocations ? double(allocations.load() - before) / repetitions : -1;
+  return {elapsed / repetitions / samples, allocs};
+}
+
+Eigen::MatrixXd to_eigen_matrix(const nnad::Matrix<double>& mat)
+{
+  Eigen::MatrixXd emat = Eigen::Map<const Eigen::Matrix<double,
+                                                       Eigen::Dynamic,
+                                                       Eigen::Dynamic,
+                                                       Eigen::RowMajor>>(mat.GetVector().data(),
+                                                                         mat.GetLines(),
+                                                                         mat.GetColumns());
+  return emat;
+}
+
+void run(const std::vector<int>& arch, size_t batch, std::vector<Measurement>& results)
+{
+  const nnad::FeedForwardNN<double> nn {arch, 0, false, nnad::Tanh<double>, nnad::dTanh<double>,
+                                        nnad::OutputFunction::ACTIVATION};
+
+  Graph graph;
+  Node* last = graph.add(new Input(size_t(arch[0])));
+  for (size_t l = 1; l < arch.size(); l++) {
+    auto layer = graph.add(new Linear(size_t(arch[l]), {last}, "layer " + std::to_string(l)));
+    layer->setWeights(to_eigen_matrix(nn.GetLinks(l)));
+    layer->setBiases(to_eigen_matrix(nn.GetBiases(l)));
+    last = graph.add(new Activation<Tanh>({layer}, "activation layer " + std::to_string(l)));
+  }
+  graph.compile(last);
+
+  const std::vector<double> x(arch[0], 0.5);
+  const Eigen::MatrixXd X = Eigen::MatrixXd::Constant(arch[0], 1, 0.5);
+  const Eigen::MatrixXd Xbatch = Eigen::MatrixXd::Random(arch[0], batch);
+  auto input = graph.GetInputNode();
+
+  auto [t_evaluate, a_evaluate] = measure([&]() { auto y = nn.Evaluate(x); }, 1);
+  auto [t_derive, a_derive] = measure([&]() { auto d = nn.Derive(x); }, 1);
+  auto [t_forward, a_forward] = measure([&]() { input->CopyValues(X); graph.forward(); }, 1);
+  auto [t_backward, a_backward] = measure([&]() { input->CopyValues(X); graph.forward(); graph.backward(); }, 1);
+  auto [t_jacobian, a_jacobian] = measure([&]() { input->CopyValues(X); graph.forward(); graph.backward(); graph.jacobian(); }, 1);
+  auto [t_batch, a_batch] = measure([&]() { input->CopyValues(Xbatch); graph.forward(); }, batch);
+
+  std::string name;
+  for (int size : arch)
+    name += (name.empty() ? "" : "-") + std::to_string(size);
+  const size_t npar = graph.getParNumber();
+  results.push_back({name, npar, "nnad_evaluate", t_evaluate, a_evaluate, 0});
+  results.push_back({name, npar, "nnad_derive", t_derive, a_derive, 0});
+  results.push_back({name, npar, "forward", t_forward, a_forward, t_evaluate / t_forward});
+  results.push_back({name, npar, "backward", t_backward, a_backward, 0});
+  results.push_back({name, npar, "jacobian", t_jacobian, a_jacobian, t_derive / t_jacobian});
+  results.push_back({name, npar, "batch", t_batch, a_batch, t_evaluate / t_batch});
+}
+
+void write_json(const std::string& path, const std::vector<Measurement>& results, size_t batch)
+{
+  std::ofstream file(path);
+  file << "{\n  \"compiler\": \"" << __VERSION__ << "\",\n"
+       << "  \"eigen\": \"" << EIGEN_WORLD_VERSION << "." << EIGEN_MAJOR_VERSION << "." << EIGEN_MINOR_VERSION << "\",\n"
+       << "  \"simd\": \"" << Eigen::SimdInstructionSetsInUse() << "\",\n"
+       << "  \"batch\": " << batch << ",\n"
+       << "  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& m = results[i];
+    file << "    {\"architecture\": \"" << m.architecture << "\", \"parameters\": " << m.parameters
+         << ", \"operation\": \"" << m.operation << "\", \"ns_per_sample\": " << m.ns_per_sample
+         << ", \"allocations_per_call\": " << m.allocations_per_call
+         << ", \"speedup_vs_nnad\": " << (m.speedup > 0 ? std::to_string(m.speedup) : "null")
+         << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  file << "  ]\n}\n";
+}
+
+int main(int argc, char** argv)
+{
+  spdlog::set_level(spdlog::level::warn);
+  const size_t batch = 256;
+  const std::vector<std::vector<int>> architectures {{3, 2, 2, 1}, {3, 10, 10, 1}, {10, 32, 32, 4},
+                                                     {50, 128, 128, 10}, {100, 256, 256, 10}};
+
+  std::vector<Measurement> results;
+  for (const auto& arch : architectures)
+    run(arch, batch, results);
+
+  std::cout << "arch\tnpar\toperation\tns/sample\tallocs/call\tspeed-up vs NNAD" << std::endl;
+  for (const auto& m : results)
+    std::cout << m.architecture << "\t" << m.parameters << "\t" << m.operation << "\t"
+              << m.ns_per_sample << "\t" << m.allocations_per_call << "\t"
+              << (m.speedup > 0 ? std::to_string(m.speedup) : "-") << std::endl;
+
+  if (argc > 1)
+    write_json(argv[1], results, batch);
+  return 0;
+}
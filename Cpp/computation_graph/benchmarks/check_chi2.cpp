@@ -0,0 +1,106 @@
+#include "nodes.hpp"
+#include <iostream>
+
+/**
+ * Check of the chi2 node against a direct computation.
+ *
+ * For a covariance shared by the samples and for the full covariance of the
+ * batch, the chi2 is compared with `r^T C^{-1} r` computed with the explicit
+ * inverse, and its gradient with respect to the parameters with finite
+ * differences. The vector-Jacobian and Jacobian-vector products are compared
+ * with the Jacobian. A forward pass without covariance, or with one of the
+ * wrong size, must give NaN.
+ *
+ * The program returns a non-zero value if a check fails.
+ */
+
+bool check(bool full, std::mt19937& generator)
+{
+  const int batch = 5, nout = 2;
+  Graph graph;
+  auto input = graph.add(new Input(size_t(3)));
+  auto layer1 = graph.add(new Linear(6, {input}, "layer 1"));
+  auto activation = graph.add(new Activation<Tanh>({layer1}, "activation layer 1"));
+  auto layer2 = graph.add(new Linear(nout, {activation}, "layer 2"));
+  auto chi2 = graph.add(new Chi2({layer2}, "chi2"));
+  for (auto layer : {layer1, layer2})
+    layer->initialise_parameters(&generator, std::tuple<double,double>(0., 1.));
+  graph.compile(chi2);
+
+  const Eigen::MatrixXd X = Eigen::MatrixXd::Random(3, batch);
+  const Eigen::MatrixXd Y = Eigen::MatrixXd::Random(nout, batch);
+  const int size = full ? nout * batch : nout;
+  const Eigen::MatrixXd A = Eigen::MatrixXd::Random(size, size);
+  const Eigen::MatrixXd C = A * A.transpose() + Eigen::MatrixXd::Identity(size, size);
+  chi2->setData(Y);
+  chi2->setCovariance(C);
+
+  auto evaluate = [&]() {
+    graph.GetInputNode()->CopyValues(X);
+    graph.forward();
+    return graph.GetOutput()(0, 0);
+  };
+  const double value = evaluate();
+
+  Eigen::MatrixXd R = layer2->GetValue() - Y;
+  double reference = 0;
+  if (full) {
+    Eigen::Map<Eigen::VectorXd> r(R.data(), R.size());
+    reference = r.dot(C.inverse() * r);
+  }
+  else
+    for (int b = 0; b < batch; b++)
+      reference += R.col(b).dot(C.inverse() * R.col(b));
+
+  graph.backward();
+  const Eigen::MatrixXd J = graph.jacobian();
+  auto parameters = graph.GetParameters();
+  const double h = 1e-6;
+  double fd = 0;
+  for (Eigen::Index i = 0; i < parameters.size(); i++) {
+    const double p = parameters(i);
+    parameters(i) = p + h;
+    const double plus = evaluate();
+    parameters(i) = p - h;
+    const double minus = evaluate();
+    parameters(i) = p;
+    fd = std::max(fd, std::abs((plus - minus) / (2 * h) - J(0, i)));
+  }
+
+  evaluate();
+  graph.ZeroGradients();
+  const Eigen::VectorXd vjp = graph.vjp(Eigen::MatrixXd::Ones(1, 1));
+  const Eigen::MatrixXd V = Eigen::MatrixXd::Random(parameters.size(), 2);
+  graph.GetInputNode()->CopyValues(X);
+  const Eigen::MatrixXd jvp = graph.jvp(V);
+
+  const double scale = std::max(1., J.cwiseAbs().maxCoeff());
+  const double value_diff = std::abs(value - reference) / std::max(1., reference);
+  const double vjp_diff = (vjp.transpose() - J).cwiseAbs().maxCoeff();
+  const double jvp_diff = (jvp - J * V).cwiseAbs().maxCoeff();
+  bool ok = value_diff < 1e-12 && fd < 1e-5 * scale && vjp_diff < 1e-12 * scale && jvp_diff < 1e-12 * scale;
+
+  // Errors are reported with a NaN value
+  chi2->setCovariance(Eigen::MatrixXd::Identity(size + 1, size + 1));
+  const bool wrong_size = std::isnan(evaluate());
+  Chi2* unset = graph.add(new Chi2({layer2}, "unset chi2"));
+  graph.compile(unset);
+  const bool missing = std::isnan(evaluate());
+  ok &= wrong_size && missing;
+
+  std::cout << (full ? "full" : "per sample") << "\t" << value << "\t" << reference << "\t"
+            << fd << "\t" << vjp_diff << "\t" << jvp_diff << "\t" << (wrong_size && missing ? "NaN" : "-") << "\t"
+            << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+int main()
+{
+  spdlog::set_level(spdlog::level::off);
+  std::mt19937 generator(1);
+
+  std::cout << "covariance\tchi2\treference\tmax|FD-J|\tmax|vjp-J|\tmax|jvp-JV|\terrors" << std::endl;
+  bool ok = check(false, generator);
+  ok &= check(true, generator);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,74 @@
+#include "nodes.hpp"
+#include <iostream>
+
+/**
+ * Check of the normal equations accumulated by the Levenberg-Marquardt fit.
+ *
+ * `J^T J`, `J^T r` and the chi2 accumulated by a pool of threads are
+ * compared with those of a single thread, and with the explicit Jacobian of
+ * the whole dataset. The datasets include fewer samples than threads, so
+ * that some workers get no samples.
+ *
+ * The program returns a non-zero value if a check fails.
+ */
+
+bool check(size_t ndata, size_t nthreads)
+{
+  std::mt19937 generator(4);
+  Graph graph;
+  Node* input = graph.add(new Input(size_t(2)));
+  auto layer1 = graph.add(new Linear(6, {input}, "layer 1"));
+  auto activation = graph.add(new Activation<Tanh>({layer1}, "activation layer 1"));
+  auto layer2 = graph.add(new Linear(3, {activation}, "layer 2"));
+  for (auto layer : {layer1, layer2})
+    layer->initialise_parameters(&generator, std::tuple<double,double>(0., 1.));
+  graph.compile(layer2);
+
+  const Eigen::MatrixXd X = Eigen::MatrixXd::Random(2, ndata);
+  const Eigen::MatrixXd Y = Eigen::MatrixXd::Random(3, ndata);
+
+  LevenbergMarquardt parallel(graph, {}, nthreads);
+  LevenbergMarquardt serial(graph, {}, 1);
+  // Twice, so that the buffers of the workers have been used already
+  for (int i = 0; i < 2; i++) {
+    parallel.accumulate(X, Y);
+    serial.accumulate(X, Y);
+  }
+
+  Eigen::MatrixXd J(3 * ndata, graph.getParNumber());
+  Eigen::VectorXd r(3 * ndata);
+  for (size_t i = 0; i < ndata; i++) {
+    graph.GetInputNode()->CopyValues(X.col(i));
+    graph.forward();
+    graph.backward();
+    J.middleRows(3 * i, 3) = graph.jacobian();
+    r.segment(3 * i, 3) = Y.col(i) - graph.GetOutput();
+  }
+  const Eigen::MatrixXd JtJ = J.transpose() * J;
+
+  auto lower = [](const Eigen::MatrixXd& m) { return Eigen::MatrixXd(m.triangularView<Eigen::Lower>()); };
+  const double tolerance = 1e-12;
+  const double jtj = (lower(parallel.GetJtJ()) - lower(serial.GetJtJ())).cwiseAbs().maxCoeff();
+  const double jtr = (parallel.GetJtr() - serial.GetJtr()).cwiseAbs().maxCoeff();
+  const double jtj_ref = (lower(parallel.GetJtJ()) - lower(JtJ)).cwiseAbs().maxCoeff();
+  const double jtr_ref = (parallel.GetJtr() - J.transpose() * r).cwiseAbs().maxCoeff();
+  const double chi2 = std::abs(parallel.GetChi2() - r.squaredNorm());
+  const double chi2_eval = std::abs(parallel.evaluate(X, Y) - r.squaredNorm());
+
+  const bool ok = std::max({jtj, jtr, jtj_ref, jtr_ref, chi2, chi2_eval}) < tolerance * std::max(1., JtJ.norm());
+  std::cout << ndata << "\t" << nthreads << "\t" << jtj << "\t" << jtr << "\t"
+            << jtj_ref << "\t" << jtr_ref << "\t" << chi2 << "\t" << chi2_eval << "\t"
+            << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+int main()
+{
+  spdlog::set_level(spdlog::level::warn);
+
+  std::cout << "ndata\tthreads\tJtJ-serial\tJtr-serial\tJtJ-explicit\tJtr-explicit\tchi2\tchi2(evaluate)" << std::endl;
+  bool ok = true;
+  for (size_t ndata : {1, 3, 7, 100})
+    ok &= check(ndata, 8);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
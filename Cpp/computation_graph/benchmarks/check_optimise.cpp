@@ -0,0 +1,104 @@
+#include "nodes.hpp"
+#include <iostream>
+
+/**
+ * Check of the rewrites done by `Graph::optimise`.
+ *
+ * The output of `forward`, the Jacobian, `vjp`, `jvp` and `evaluate` are
+ * computed on a batch before and after `optimise`, and they must not
+ * change. The first network is a 3-8-5-2 one with tanh activations and a
+ * node the output does not depend on, so the layers are fused and the node
+ * is deleted. The second one reads a constant input through a tanh, which
+ * is folded into a constant, before the same layers.
+ *
+ * The program returns a non-zero value if a check fails.
+ */
+
+struct Results {
+  Eigen::MatrixXd forward, jacobian, vjp, jvp, evaluate;
+};
+
+Results run(Graph& graph, const Eigen::MatrixXd& X, const Eigen::MatrixXd& R, const Eigen::MatrixXd& V)
+{
+  Results results;
+  auto input = [&]() {
+    if (X.size() > 0)
+      graph.GetInputNode()->CopyValues(X);
+  };
+  input();
+  graph.forward();
+  results.forward = graph.GetOutput();
+  graph.backward();
+  results.jacobian = graph.jacobian();
+  graph.ZeroGradients();
+  results.vjp = graph.vjp(R);
+  input();
+  results.jvp = graph.jvp(V);
+  auto workspace = graph.MakeWorkspace(R.cols());
+  if (graph.evaluate(X, workspace))
+    results.evaluate = workspace.GetOutput();
+  return results;
+}
+
+double difference(const Eigen::MatrixXd& a, const Eigen::MatrixXd& b)
+{
+  if (a.rows() != b.rows() || a.cols() != b.cols())
+    return std::numeric_limits<double>::infinity();
+  return (a - b).cwiseAbs().maxCoeff() / std::max(1., b.cwiseAbs().maxCoeff());
+}
+
+bool check(bool constant)
+{
+  std::mt19937 generator(3);
+  const Eigen::Index batch = 4;
+  Graph graph;
+  auto input = graph.add(new Input(size_t(3)));
+  Node* last = input;
+  if (constant) {
+    input->SetConstant();
+    input->CopyValues(Eigen::MatrixXd::Random(3, batch));
+    last = graph.add(new Activation<Tanh>({last}, "constant activation"));
+  }
+  auto layer1 = graph.add(new Linear(8, {last}, "layer 1"));
+  auto activation1 = graph.add(new Activation<Tanh>({layer1}, "activation layer 1"));
+  auto layer2 = graph.add(new Linear(5, {activation1}, "layer 2"));
+  auto activation2 = graph.add(new Activation<Tanh>({layer2}, "activation layer 2"));
+  auto layer3 = graph.add(new Linear(2, {activation2}, "layer 3"));
+  graph.add(new Activation<Tanh>({activation2}, "unused activation"));
+  for (auto layer : {layer1, layer2, layer3})
+    layer->initialise_parameters(&generator, std::tuple<double,double>(0., 1.));
+  graph.compile(layer3);
+
+  const Eigen::MatrixXd X = constant ? Eigen::MatrixXd() : Eigen::MatrixXd::Random(3, batch);
+  const Eigen::MatrixXd R = Eigen::MatrixXd::Random(2, batch);
+  const Eigen::MatrixXd V = Eigen::MatrixXd::Random(graph.getParNumber(), 3);
+  const size_t nodes = graph.GetOrder().size();
+  const Results before = run(graph, X, R, V);
+  graph.optimise();
+  const Results after = run(graph, X, R, V);
+
+  const double forward = difference(after.forward, before.forward);
+  const double jacobian = difference(after.jacobian, before.jacobian);
+  const double vjp = difference(after.vjp, before.vjp);
+  const double jvp = difference(after.jvp, before.jvp);
+  const double evaluate = difference(after.evaluate, before.evaluate);
+  const double tolerance = 1e-14;
+
+  const bool ok = graph.GetOrder().size() < nodes && forward < tolerance && jacobian < tolerance &&
+                  vjp < tolerance && jvp < tolerance && evaluate < tolerance;
+  std::cout << (constant ? "constant" : "variable") << "\t" << nodes << " -> " << graph.GetOrder().size() << "\t"
+            << forward << "\t" << jacobian << "\t" << vjp << "\t" << jvp << "\t" << evaluate << "\t"
+            << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+int main()
+{
+  spdlog::set_level(spdlog::level::err);
+
+  std::cout << "input\tnodes\tforward\tjacobian\tvjp\tjvp\tevaluate" << std::endl;
+  bool ok = true;
+  for (bool constant : {false, true})
+    ok &= check(constant);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
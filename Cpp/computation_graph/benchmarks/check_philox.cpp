@@ -0,0 +1,98 @@
+#include "nodes.hpp"
+#include <iostream>
+
+/**
+ * Check of the counter-based generator and of the parallel initialisation.
+ *
+ * The blocks of `Philox4x32` are compared with the known-answer vectors of
+ * Philox4x32-10 published with Random123. The four words of the counter
+ * there are the counter (low words) and the stream (high words) here, and
+ * the two words of the key are the seed. Then the parameters of a graph
+ * and of an ensemble, drawn with `initialise_parameters(rng, pool, t)` on
+ * 1 to 8 threads, must be the ones drawn serially with the same seed.
+ *
+ * The program returns a non-zero value if a check fails.
+ */
+
+struct KnownAnswer {
+  std::array<uint32_t, 4> counter;
+  std::array<uint32_t, 2> key;
+  Philox4x32::Block expected;
+};
+
+bool check(const KnownAnswer& kat)
+{
+  auto join = [](uint32_t lo, uint32_t hi) { return uint64_t(hi) << 32 | lo; };
+  const Philox4x32 generator(join(kat.key[0], kat.key[1]), join(kat.counter[2], kat.counter[3]));
+  const Philox4x32::Block block = generator(join(kat.counter[0], kat.counter[1]));
+
+  const bool ok = block == kat.expected;
+  std::cout << "known answer" << std::hex;
+  for (uint32_t word : block)
+    std::cout << "\t" << word;
+  std::cout << std::dec << "\t" << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+// Parameters of a 10-64-64-3 graph drawn from seed 7, serially if `pool`
+// is null
+Eigen::VectorXd graph_parameters(ThreadPool* pool)
+{
+  Philox4x32 generator(7);
+  Graph graph;
+  Node* last = graph.add(new Input(size_t(10)));
+  const std::vector<int> widths = {64, 64, 3};
+  for (size_t l = 0; l < widths.size(); l++) {
+    auto layer = graph.add(new Linear(widths[l], {last}, "layer " + std::to_string(l + 1)));
+    if (pool)
+      layer->initialise_parameters(&generator, *pool, std::tuple<double,double>(0., 1.));
+    else
+      layer->initialise_parameters(&generator, std::tuple<double,double>(0., 1.));
+    last = layer;
+  }
+  graph.compile(last);
+  return graph.GetParameters();
+}
+
+// Same as above for an ensemble of 16 replicas
+Eigen::VectorXd ensemble_parameters(ThreadPool* pool)
+{
+  Philox4x32 generator(7);
+  Ensemble<> ensemble({10, 64, 64, 3}, 16, false, 1);
+  if (pool)
+    ensemble.initialise_parameters(&generator, *pool, std::tuple<double,double>(0., 1.));
+  else
+    ensemble.initialise_parameters(&generator, std::tuple<double,double>(0., 1.));
+  return ensemble.GetParameters();
+}
+
+bool check(size_t nthreads)
+{
+  ThreadPool pool(nthreads);
+  const double graph = (graph_parameters(&pool) - graph_parameters(nullptr)).cwiseAbs().maxCoeff();
+  const double ensemble = (ensemble_parameters(&pool) - ensemble_parameters(nullptr)).cwiseAbs().maxCoeff();
+
+  const bool ok = graph == 0 && ensemble == 0;
+  std::cout << nthreads << " threads\t" << graph << "\t" << ensemble << "\t" << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+int main()
+{
+  spdlog::set_level(spdlog::level::warn);
+
+  const std::vector<KnownAnswer> kats = {
+    {{0, 0, 0, 0}, {0, 0}, {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}},
+    {{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, {0xffffffff, 0xffffffff},
+     {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}},
+    {{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, {0xa4093822, 0x299f31d0},
+     {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}}};
+  bool ok = true;
+  for (const auto& kat : kats)
+    ok &= check(kat);
+
+  std::cout << "threads\tmax|graph-serial|\tmax|ensemble-serial|" << std::endl;
+  for (size_t nthreads : {1, 2, 3, 8})
+    ok &= check(nthreads);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
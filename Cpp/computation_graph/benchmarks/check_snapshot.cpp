@@ -0,0 +1,117 @@
+#include "nodes.hpp"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+/**
+ * Check of the snapshots of the parameters.
+ *
+ * Three replicas of a 3-8-2 network are saved, and the file is loaded and
+ * bound to clones of the graph: the parameters of each clone must be the
+ * saved ones, read from the mapping without a copy, and its output the one
+ * of the graph with the same parameters. Then copies of the file truncated
+ * in the header and in the parameters must be rejected by `load`, and
+ * graphs with another architecture by `bind`, including one with the same
+ * number of layers and parameters but other shapes.
+ *
+ * The program returns a non-zero value if a check fails.
+ */
+
+// Network with tanh activations, `widths[0]` is the input size
+void build(Graph& graph, const std::vector<int>& widths)
+{
+  Node* last = graph.add(new Input(size_t(widths[0])));
+  for (size_t l = 1; l < widths.size(); l++) {
+    last = graph.add(new Linear(widths[l], {last}, "layer " + std::to_string(l)));
+    if (l + 1 < widths.size())
+      last = graph.add(new Activation<Tanh>({last}, "activation layer " + std::to_string(l)));
+  }
+  graph.compile(last);
+}
+
+// Copy of the first `size` bytes of a file
+void truncate(const std::string& from, const std::string& to, size_t size)
+{
+  std::ifstream in(from, std::ios::binary);
+  std::vector<char> bytes(size);
+  in.read(bytes.data(), size);
+  std::ofstream(to, std::ios::binary).write(bytes.data(), size);
+}
+
+bool check_round_trip(const std::string& path)
+{
+  Graph graph;
+  build(graph, {3, 8, 2});
+  const Eigen::MatrixXd replicas = Eigen::MatrixXd::Random(graph.getParNumber(), 3);
+  const Eigen::MatrixXd X = Eigen::MatrixXd::Random(3, 4);
+
+  Snapshot snapshot;
+  bool ok = Snapshot::save(path, graph, replicas) && snapshot.load(path);
+  double parameters = 0, outputs = 0;
+  for (Eigen::Index r = 0; ok && r < replicas.cols(); r++) {
+    auto worker = graph.clone();
+    ok &= snapshot.bind(*worker, r);
+    ok &= worker->GetParameters().data() == snapshot.GetReplica(r).get();
+    parameters = std::max(parameters, (worker->GetParameters() - replicas.col(r)).cwiseAbs().maxCoeff());
+
+    graph.GetParameters() = replicas.col(r);
+    graph.setInput(Eigen::MatrixXd(X));
+    graph.forward();
+    worker->setInput(Eigen::MatrixXd(X));
+    worker->forward();
+    outputs = std::max(outputs, (worker->GetOutput() - graph.GetOutput()).cwiseAbs().maxCoeff());
+  }
+
+  ok &= parameters == 0 && outputs == 0;
+  std::cout << "round trip\t" << parameters << "\t" << outputs << "\t" << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+bool check_truncated(const std::string& path)
+{
+  const size_t size = std::filesystem::file_size(path);
+  bool ok = true;
+  for (size_t kept : {size_t(32), size - 1}) {
+    const std::string truncated = path + ".truncated";
+    truncate(path, truncated, kept);
+    Snapshot snapshot;
+    const bool loaded = snapshot.load(truncated);
+    std::filesystem::remove(truncated);
+    ok &= !loaded;
+    std::cout << "truncated to " << kept << " bytes\t" << (loaded ? "loaded" : "rejected") << "\t"
+              << (loaded ? "FAILED" : "ok") << std::endl;
+  }
+  return ok;
+}
+
+bool check_architecture(const std::string& path)
+{
+  Snapshot snapshot;
+  if (!snapshot.load(path))
+    return false;
+  bool ok = true;
+  for (const std::vector<int>& widths : {std::vector<int>{3, 9, 2}, {9, 5}, {3, 2, 14}}) {
+    Graph graph;
+    build(graph, widths);
+    const bool bound = snapshot.bind(graph);
+    ok &= !bound;
+    std::string name;
+    for (int w : widths)
+      name += (name.empty() ? "" : "-") + std::to_string(w);
+    std::cout << "architecture " << name << " (" << graph.getParNumber() << " parameters)\t"
+              << (bound ? "bound" : "rejected") << "\t" << (bound ? "FAILED" : "ok") << std::endl;
+  }
+  return ok;
+}
+
+int main()
+{
+  spdlog::set_level(spdlog::level::off);
+
+  const std::string path = (std::filesystem::temp_directory_path() / "check_snapshot.bin").string();
+  bool ok = check_round_trip(path);
+  ok &= check_truncated(path);
+  ok &= check_architecture(path);
+  std::filesystem::remove(path);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,63 @@
+#include "nodes.hpp"
+#include <iostream>
+
+/**
+ * Check of the first-order training loop.
+ *
+ * A small network is fitted to a sine with `SGD` and with `Adam`, once with
+ * a single thread and once with the parameter update split over a pool. The
+ * loss must decrease by two orders of magnitude, and as the update of each
+ * parameter does not depend on the others, the parameters found with the
+ * pool must be the same as the single-threaded ones.
+ *
+ * The program returns a non-zero value if a check fails.
+ */
+
+template <typename Optimizer>
+Eigen::VectorXd train(const Optimizer& optimizer, size_t nthreads, double& initial, double& final)
+{
+  std::mt19937 generator(2);
+  Graph graph;
+  auto input = graph.add(new Input(size_t(1)));
+  auto layer1 = graph.add(new Linear(16, {input}, "layer 1"));
+  auto activation1 = graph.add(new Activation<Tanh>({layer1}, "activation layer 1"));
+  auto layer2 = graph.add(new Linear(1, {activation1}, "layer 2"));
+  for (auto layer : {layer1, layer2})
+    layer->initialise_parameters(&generator, std::tuple<double,double>(0., 1.));
+  graph.compile(layer2);
+
+  const Eigen::MatrixXd X = 3 * Eigen::MatrixXd::Random(1, 64);
+  const Eigen::MatrixXd Y = X.array().sin().matrix();
+  Trainer<Optimizer> trainer(graph, optimizer, nthreads);
+  initial = trainer.step(X, Y);
+  for (int i = 0; i < 2000; i++)
+    final = trainer.step(X, Y);
+  return graph.GetParameters();
+}
+
+template <typename Optimizer>
+bool check(const std::string& name, const Optimizer& optimizer)
+{
+  double initial, final, threaded_initial, threaded_final;
+  std::srand(1);
+  const Eigen::VectorXd serial = train(optimizer, 1, initial, final);
+  std::srand(1);
+  const Eigen::VectorXd threaded = train(optimizer, 3, threaded_initial, threaded_final);
+  const double diff = (threaded - serial).cwiseAbs().maxCoeff();
+
+  const bool ok = final < 1e-2 * initial && diff == 0 && threaded_final == final;
+  std::cout << name << "\t" << initial << "\t" << final << "\t" << threaded_final << "\t" << diff << "\t"
+            << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+int main()
+{
+  spdlog::set_level(spdlog::level::warn);
+
+  std::cout << "optimizer\tinitial loss\tfinal loss\tfinal loss (3 threads)\tmax|p3-p1|" << std::endl;
+  bool ok = true;
+  ok &= check("SGD", SGD(0.05, 0.9));
+  ok &= check("Adam", Adam(0.01));
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,105 @@
+#include "nodes.hpp"
+#include <iostream>
+
+/**
+ * Check of the vector-Jacobian and Jacobian-vector products.
+ *
+ * The Jacobian of each sample of the batch is assembled one sample at a
+ * time and compared with central finite differences of the output. Then
+ * `vjp(R)` is compared with `sum_b J_b^T R.col(b)`, and column
+ * `k * batch + b` of `jvp(V)` with `J_b V.col(k)`. A second `vjp` must add
+ * the same vector to the arena. The graph is checked as built and after
+ * `optimise`, which fuses the linear layers with their activations.
+ *
+ * The program returns a non-zero value if a check fails.
+ */
+
+bool check(Eigen::Index batch, bool optimised)
+{
+  std::mt19937 generator(5);
+  const int nin = 3, nout = 2;
+  Graph graph;
+  auto input = graph.add(new Input(size_t(nin)));
+  auto layer1 = graph.add(new Linear(8, {input}, "layer 1"));
+  auto activation1 = graph.add(new Activation<Tanh>({layer1}, "activation layer 1"));
+  auto layer2 = graph.add(new Linear(5, {activation1}, "layer 2"));
+  auto activation2 = graph.add(new Activation<Tanh>({layer2}, "activation layer 2"));
+  auto layer3 = graph.add(new Linear(nout, {activation2}, "layer 3"));
+  for (auto layer : {layer1, layer2, layer3})
+    layer->initialise_parameters(&generator, std::tuple<double,double>(0., 1.));
+  graph.compile(layer3);
+  if (optimised)
+    graph.optimise();
+
+  const Eigen::Index npar = graph.getParNumber();
+  const Eigen::MatrixXd X = Eigen::MatrixXd::Random(nin, batch);
+  auto output = [&](const Eigen::VectorXd& x) {
+    graph.GetInputNode()->CopyValues(x);
+    graph.forward();
+    return Eigen::VectorXd(graph.GetOutput());
+  };
+
+  // Jacobian of each sample, and its finite-difference estimate
+  std::vector<Eigen::MatrixXd> J(batch);
+  auto parameters = graph.GetParameters();
+  const double h = 1e-6;
+  double fd = 0;
+  for (Eigen::Index b = 0; b < batch; b++) {
+    output(X.col(b));
+    graph.backward();
+    J[b] = graph.jacobian();
+    for (Eigen::Index i = 0; i < npar; i++) {
+      const double p = parameters(i);
+      parameters(i) = p + h;
+      const Eigen::VectorXd plus = output(X.col(b));
+      parameters(i) = p - h;
+      const Eigen::VectorXd minus = output(X.col(b));
+      parameters(i) = p;
+      fd = std::max(fd, ((plus - minus) / (2 * h) - J[b].col(i)).cwiseAbs().maxCoeff());
+    }
+  }
+
+  // Products for the whole batch
+  const Eigen::MatrixXd R = Eigen::MatrixXd::Random(nout, batch);
+  const Eigen::MatrixXd V = Eigen::MatrixXd::Random(npar, 3);
+  Eigen::VectorXd JtR = Eigen::VectorXd::Zero(npar);
+  Eigen::MatrixXd JV(nout, V.cols() * batch);
+  for (Eigen::Index b = 0; b < batch; b++) {
+    JtR += J[b].transpose() * R.col(b);
+    for (Eigen::Index k = 0; k < V.cols(); k++)
+      JV.col(k * batch + b) = J[b] * V.col(k);
+  }
+
+  graph.GetInputNode()->CopyValues(X);
+  graph.forward();
+  graph.ZeroGradients();
+  const Eigen::VectorXd vjp = graph.vjp(R);
+  const Eigen::VectorXd twice = graph.vjp(R);
+  graph.GetInputNode()->CopyValues(X);
+  const Eigen::MatrixXd jvp = graph.jvp(V);
+
+  double scale = 1;
+  for (const auto& Jb : J)
+    scale = std::max(scale, Jb.cwiseAbs().maxCoeff());
+  const double vjp_diff = (vjp - JtR).cwiseAbs().maxCoeff();
+  const double twice_diff = (twice - 2 * JtR).cwiseAbs().maxCoeff();
+  const double jvp_diff = (jvp - JV).cwiseAbs().maxCoeff();
+  const double tolerance = 1e-12 * scale * npar;
+
+  const bool ok = fd < 1e-5 * scale && vjp_diff < tolerance && twice_diff < tolerance && jvp_diff < tolerance;
+  std::cout << batch << "\t" << (optimised ? "yes" : "no") << "\t" << fd << "\t" << vjp_diff << "\t"
+            << twice_diff << "\t" << jvp_diff << "\t" << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+int main()
+{
+  spdlog::set_level(spdlog::level::warn);
+
+  std::cout << "batch\toptimised\tmax|FD-J|\tmax|vjp-JtR|\tmax|2vjp-2JtR|\tmax|jvp-JV|" << std::endl;
+  bool ok = true;
+  for (Eigen::Index batch : {1, 4})
+    for (bool optimised : {false, true})
+      ok &= check(batch, optimised);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
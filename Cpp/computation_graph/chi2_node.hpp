@@ -0,0 +1,162 @@
+#include "./node.hpp"
+#include <eigen3/Eigen/Cholesky>
+#include <limits>
+#include <memory>
+
+#ifndef INCLUDE_CHI2_NODE
+#define INCLUDE_CHI2_NODE
+
+/**
+ * @brief Chi-squared loss `r^T C^{-1} r`, with `r = f - y`
+ *
+ * @tparam P specifies the numeric types (see `Precision`). The covariance
+ *         and the solves are in `P::GradScalar`.
+ *
+ * @details The node depends on the prediction `f` (one column per sample)
+ *          and holds the data `y` and the experimental covariance `C`. The
+ *          Cholesky factor of `C` is computed once, when the covariance is
+ *          set, and it is shared by the clones of the node. Every forward
+ *          pass solves `C w = r` with two triangular solves, and `w` is kept
+ *          for the backward pass, where the gradient is `2 w`. `C` is never
+ *          inverted.
+ *
+ *          The covariance can be either
+ *          - `nout x nout`: the same covariance for every sample, with
+ *            uncorrelated samples, or
+ *          - `(nout * batch) x (nout * batch)`: the full covariance of the
+ *            batch, with the residuals stacked sample by sample.
+ *
+ *          The value is a single number for the whole batch, so the node has
+ *          batch size 1, and it spreads the gradient over the samples of its
+ *          dependency (one row per sample). The Jacobian of the graph is then
+ *          the gradient of the chi2 with respect to the parameters.
+ */
+template <typename P = DoublePrecision>
+class Chi2Template : public NodeTemplate<P>
+{
+  public:
+    using Base = NodeTemplate<P>;
+    using typename Base::VecDep;
+    using typename Base::Matrix;
+    using typename Base::GradScalar;
+    using typename Base::GradMatrix;
+    using typename Base::GradVector;
+    using Cholesky = Eigen::LLT<GradMatrix>;
+
+    Chi2Template(VecDep&& dependencies, std::string&& Id)
+    : Base(std::forward<VecDep>(dependencies), std::forward<std::string>(Id))
+    {
+      inSize_ = dependencies_[0]->GetOutSize();
+      outSize_ = 1;
+    }
+
+    ~Chi2Template() {}
+
+    // The clone shares data and Cholesky factor with the original node
+    virtual Base* clone(VecDep&& dependencies) const override
+    {
+      Chi2Template* node = new Chi2Template(std::move(dependencies), std::string(Id_));
+      node->data_ = data_;
+      node->cholesky_ = cholesky_;
+      return node;
+    }
+
+    // Data, one column per sample
+    void setData(const Matrix& data)
+    {
+      data_ = std::make_shared<const Matrix>(data);
+      this->Invalidate();
+    }
+
+    /**
+     * @brief Sets the covariance and computes its Cholesky factor
+     *
+     * @return false if the covariance is not positive definite
+     */
+    bool setCovariance(const GradMatrix& covariance)
+    {
+      auto cholesky = std::make_shared<Cholesky>(covariance);
+      if (cholesky->info() != Eigen::Success) {
+        spdlog::error("The covariance of {0} is not positive definite", Id_);
+        return false;
+      }
+      cholesky_ = std::move(cholesky);
+      this->Invalidate();
+      return true;
+    }
+
+    // The value is NaN if data and covariance are missing or do not match
+    // the prediction
+    virtual void forward() override
+    {
+      const auto& prediction = dependencies_[0]->GetValue();
+      if (!data_ || !cholesky_) {
+        spdlog::error("Data and covariance of {0} must be set before the forward pass", Id_);
+        value_.setConstant(1, 1, std::numeric_limits<typename Base::Scalar>::quiet_NaN());
+        return;
+      }
+      const Eigen::Index size = prediction.size();
+      if (data_->rows() != prediction.rows() || data_->cols() != prediction.cols() ||
+          (cholesky_->rows() != prediction.rows() && cholesky_->rows() != size)) {
+        spdlog::error("{0}: the data ({1} x {2}) and the covariance ({3} x {3}) do not match the prediction ({4} x {5})",
+                      Id_, data_->rows(), data_->cols(), cholesky_->rows(), prediction.rows(), prediction.cols());
+        value_.setConstant(1, 1, std::numeric_limits<typename Base::Scalar>::quiet_NaN());
+        return;
+      }
+      residuals_ = (prediction - *data_).template cast<GradScalar>();
+      weighted_ = residuals_;
+      if (cholesky_->rows() == residuals_.rows())
+        cholesky_->solveInPlace(weighted_);
+      else {
+        Eigen::Map<GradVector> w(weighted_.data(), weighted_.size());
+        cholesky_->solveInPlace(w);
+      }
+      chi2_ = residuals_.cwiseProduct(weighted_).sum();
+      value_.setConstant(1, 1, chi2_);
+    }
+
+    // The gradient of the chi2 with respect to the sample b is the b-th
+    // column of `2 w`, which goes in the block of the b-th sample of the
+    // gradient of the dependency
+    virtual void backward() override
+    {
+      auto dep = dependencies_[0];
+      const Eigen::Index batch = weighted_.cols();
+      const Eigen::Index rows = gradient_.rows();
+      dep->ReshapeGradient(rows * batch);
+      for (Eigen::Index b = 0; b < batch; b++)
+        dep->AccumulateGradient(2 * gradient_.col(0) * weighted_.col(b).transpose(), b * rows);
+    }
+
+    // The tangent of the chi2 along the k-th direction is `2 w . t_k`
+    virtual void tangent(const Eigen::Ref<const GradMatrix>& directions) override
+    {
+      const GradMatrix& t = dependencies_[0]->GetTangent();
+      const Eigen::Index batch = weighted_.cols();
+      tangent_.resize(1, directions.cols());
+      for (Eigen::Index k = 0; k < directions.cols(); k++)
+        tangent_(0, k) = 2 * t.middleCols(k * batch, batch).cwiseProduct(weighted_).sum();
+    }
+
+    GradScalar GetChi2() const { return chi2_; }
+    // Residuals `f - y` and `C^{-1} (f - y)` of the last forward pass
+    const GradMatrix& GetResiduals() const { return residuals_; }
+    const GradMatrix& GetWeightedResiduals() const { return weighted_; }
+
+  private:
+    using Base::value_;
+    using Base::gradient_;
+    using Base::tangent_;
+    using Base::outSize_;
+    using Base::inSize_;
+    using Base::dependencies_;
+    using Base::Id_;
+
+    std::shared_ptr<const Matrix> data_;
+    std::shared_ptr<const Cholesky> cholesky_;
+    GradMatrix residuals_;
+    GradMatrix weighted_;
+    GradScalar chi2_ = 0;
+};
+using Chi2 = Chi2Template<>;
+#endif
@@ -0,0 +1,652 @@
+#include "./node.hpp"
+#include "./input_node.hpp"
+#include "./workspace.hpp"
+#include <memory>
+#include <unordered_set>
+#include <unordered_map>
+
+#ifndef INCLUDE_COMPUTATION_GRAPH
+#define INCLUDE_COMPUTATION_GRAPH
+
+/**
+ * @brief Executor of a graph of nodes
+ *
+ * @details The graph owns its nodes. The execution order is worked out once
+ *          from the dependencies of the output node (see `compile`), and
+ *          then it is reused by the forward, backward and Jacobian passes.
+ *          Nodes that do not contribute to the output are never scheduled.
+ *
+ *          The parameters in the Jacobian are ordered as the nodes in the
+ *          execution order, i.e. the first layer comes first.
+ * 
+ *          The parameters of all the nodes are stored in a single contiguous
+ *          buffer (the arena), in the same order as in the Jacobian, and so
+ *          are their gradients. The nodes only hold views on the arena, so
+ *          the whole model can be read or updated as one vector. The
+ *          clones of a graph share its arena, and they follow it when the
+ *          graph is bound to a new one (see `clone`).
+ *
+ * @tparam P is the precision of the nodes (see `precision.hpp`)
+ */
+template <typename P = DoublePrecision>
+class GraphTemplate
+{
+  public:
+    using NodeType = NodeTemplate<P>;
+    using NodePtr = typename NodeType::NodePtr;
+    using Scalar = typename P::Scalar;
+    using GradScalar = typename P::GradScalar;
+    using Matrix = typename P::Matrix;
+    using Vector = typename P::Vector;
+    using GradMatrix = typename P::GradMatrix;
+    using GradVector = typename P::GradVector;
+
+    GraphTemplate() {}
+    GraphTemplate(const GraphTemplate&) = delete;
+    GraphTemplate& operator=(const GraphTemplate&) = delete;
+
+    /**
+     * @brief Adds a node to the graph, which takes its ownership
+     *
+     * @return the same pointer, with its type preserved
+     */
+    template <typename DerivedNode>
+    DerivedNode* add(DerivedNode* node)
+    {
+      node->SetClock(clock_);
+      nodes_.emplace_back(node);
+      compiled_ = false;
+      return node;
+    }
+
+    /**
+     * @brief Creates a lightweight copy of the graph
+     * 
+     * @details Only the nodes in the execution order are cloned, and the
+     *          clones share the parameters with the original nodes. Each clone
+     *          has its own values and gradients (including the gradient
+     *          arena), so clones can be evaluated concurrently as long as the
+     *          parameters are not modified.
+     * 
+     *          If the graph is later bound to another arena (by `compile`,
+     *          when the layout of the parameters changes, or by
+     *          `BindParameters`), the clones are bound to it at their next
+     *          forward pass. A clone whose number of parameters no longer
+     *          matches reports an error instead. A clone stops following the
+     *          graph once it is bound to a buffer of its own, e.g. a replica
+     *          of a `Snapshot`.
+     */
+    std::unique_ptr<GraphTemplate> clone()
+    {
+      if (!compiled_)
+        compile(output_);
+      if (!compiled_)
+        return std::make_unique<GraphTemplate>();
+      follow_arena();
+      auto graph = std::make_unique<GraphTemplate>();
+      graph->clock_->parameters = clock_->parameters;
+      graph->source_ = arena_;
+      std::unordered_map<NodePtr, NodePtr> clones;
+      for (auto node : order_) {
+        typename NodeType::VecDep dependencies;
+        for (auto dep : node->GetDependencies())
+          dependencies.push_back(clones.at(dep));
+        clones[node] = graph->add(node->clone(std::move(dependencies)));
+      }
+      for (const auto& [id, node] : aliases_)
+        graph->aliases_[id] = clones.at(node);
+      graph->compile(clones.at(output_), parameters_);
+      return graph;
+    }
+
+    /**
+     * @brief Computes the execution order and the position of the
+     *        parameters of each node in the Jacobian
+     *
+     * @param output is the node whose value is returned by the graph. If
+     *        null, the last node added to the graph is used.
+     * 
+     * @details The arena is kept if every node with parameters keeps its
+     *          position in it. Otherwise a new arena is allocated, and the
+     *          current parameters of the nodes are moved into it.
+     */
+    void compile(NodePtr output = nullptr)
+    {
+      compile(output, nullptr);
+    }
+
+    /**
+     * @brief Rewrites the graph into an equivalent one that is cheaper to run
+     * 
+     * @param output is the node whose value is returned by the graph, as
+     *        for `compile`
+     * @param keep are the ids of nodes that must not be fused into the node
+     *        that follows them, e.g. because their own value is needed
+     * 
+     * @details The rewrites are
+     *          - constant folding: nodes without parameters whose dependencies
+     *            are all constant (see `Input::SetConstant`) are evaluated once
+     *            and replaced by constant inputs with the same id,
+     *          - fusion: a node and its dependency are replaced by a single
+     *            node (see `Node::fuse`), e.g. `Linear` followed by
+     *            `Activation`, if nothing else depends on the dependency. The
+     *            fused node takes the id of the node, and the id of the
+     *            dependency is kept as an alias (see `GetNode`). The alias
+     *            has the parameters of the dependency, but the value of the
+     *            fused node, so nodes whose value is read should be kept with
+     *            `keep`,
+     *          - dead-node elimination: the nodes the output does not depend
+     *            on are deleted.
+     * 
+     *          The values of the output, the parameters and their order in
+     *          the Jacobian do not change. Pointers to nodes that have been
+     *          replaced or deleted are invalidated, so nodes should be looked
+     *          up again by id.
+     */
+    void optimise(NodePtr output = nullptr, const std::unordered_set<std::string>& keep = {})
+    {
+      compile(output ? output : output_);
+      std::unordered_map<NodePtr, std::vector<NodePtr>> consumers;
+      auto find_consumers = [&]() {
+        consumers.clear();
+        for (auto node : order_)
+          for (auto dep : node->GetDependencies())
+            consumers[dep].push_back(node);
+      };
+      find_consumers();
+
+      auto replace = [&](NodePtr node, NodePtr replacement) {
+        for (auto consumer : consumers[node])
+          consumer->ReplaceDependency(node, replacement);
+        consumers[replacement] = consumers[node];
+        if (output_ == node)
+          output_ = replacement;
+      };
+
+      // Constant folding
+      size_t folded = 0;
+      std::unordered_set<NodePtr> constants;
+      for (auto node : order_) {
+        const auto dependencies = node->GetDependencies();
+        if (node->IsConstant())
+          constants.insert(node);
+        else if (!dependencies.empty() && node->getParNumber() == 0 &&
+                 std::all_of(dependencies.begin(), dependencies.end(), [&](NodePtr dep) { return constants.count(dep) > 0; })) {
+          auto constant = add(new InputTemplate<P>(size_t(node->GetOutSize()), {}, node->GetId()));
+          constant->CopyValues(node->GetValue());
+          constant->SetConstant();
+          replace(node, constant);
+          constants.insert(constant);
+          folded++;
+        }
+      }
+      compile(output_);
+      find_consumers();
+
+      // Fusion
+      size_t fused = 0;
+      const std::vector<NodePtr> order = order_;
+      for (auto node : order) {
+        const auto dependencies = node->GetDependencies();
+        if (dependencies.size() != 1 || dependencies[0] == output_ || consumers[dependencies[0]].size() != 1 ||
+            keep.count(dependencies[0]->GetId()) > 0)
+          continue;
+        if (NodePtr fusion = node->fuse()) {
+          add(fusion);
+          replace(node, fusion);
+          aliases_[dependencies[0]->GetId()] = fusion;
+          fused++;
+        }
+      }
+      compile(output_);
+
+      // Dead-node elimination
+      const std::unordered_set<NodePtr> live(order_.begin(), order_.end());
+      const size_t before = nodes_.size();
+      std::erase_if(nodes_, [&](const auto& node) { return live.count(node.get()) == 0; });
+      std::erase_if(aliases_, [&](const auto& alias) { return live.count(alias.second) == 0; });
+      spdlog::info("Graph optimised: {0} nodes folded, {1} fused, {2} removed", folded, fused, before - nodes_.size());
+    }
+
+    // Node with the given id, looked up among the nodes of the graph and the
+    // aliases left by `optimise`. Null if there is none. The id of a node
+    // fused by `optimise` gives the fused node: same parameters, but its
+    // value is the one of the node it has been fused into (e.g. after the
+    // activation instead of before).
+    NodePtr GetNode(const std::string& Id) const
+    {
+      for (const auto& node : nodes_)
+        if (node->GetId() == Id)
+          return node.get();
+      auto alias = aliases_.find(Id);
+      return alias != aliases_.end() ? alias->second : nullptr;
+    }
+
+    // Sets the values of the first input node (one column per sample)
+    void setInput(Matrix&& x)
+    {
+      if (!compiled_)
+        compile(output_);
+      if (inputs_.empty()) {
+        spdlog::error("The graph has no input that is not constant");
+        return;
+      }
+      inputs_[0]->setValues(std::move(x));
+    }
+
+    /**
+     * @brief Brings the values of all the nodes up to date
+     * 
+     * @details Only the nodes downstream of an input or of parameters that
+     *          changed since the last pass are recomputed (see `Node::update`).
+     */
+    void forward()
+    {
+      if (!compiled_)
+        compile(output_);
+      if (!follow_arena())
+        return;
+      for (auto node : order_)
+        node->update();
+    }
+
+    using Workspace = WorkspaceTemplate<P>;
+
+    // Buffers for `evaluate`, one per thread. The graph must be compiled.
+    Workspace MakeWorkspace(size_t batch = 1) const
+    {
+      if (!compiled_)
+        spdlog::error("The graph must be compiled before creating a workspace");
+      return Workspace(order_, batch);
+    }
+
+    /**
+     * @brief Forward pass that does not modify the graph
+     * 
+     * @param X contains the values of the first input that is not constant,
+     *        one column per sample. Constant inputs keep their own value.
+     * @param workspace receives the values of the nodes, and the output is
+     *        `workspace.GetOutput()`
+     * @return false if a node does not support it (see `Node::evaluate`)
+     * 
+     * @details The nodes are only read, so many threads can evaluate the
+     *          same graph at once, each one with its own workspace, as long
+     *          as the parameters do not change. The values cached in the
+     *          nodes (see `forward`) are not touched.
+     */
+    bool evaluate(const Matrix& X, Workspace& workspace) const
+    {
+      if (source_ && source_->parameters != parameters_) {
+        spdlog::error("The parameters have been bound to another arena, run a forward pass first");
+        return false;
+      }
+      for (size_t i = 0; i < order_.size(); i++) {
+        Matrix& value = workspace.values_[i];
+        const size_t dependency = workspace.dependency_[i];
+        if (order_[i]->IsConstant())
+          continue;
+        if (dependency == Workspace::no_dependency) {
+          if (inputs_.empty() || order_[i] != inputs_[0]) {
+            spdlog::error("Node {0}: only the first input is supported by evaluate", order_[i]->GetId());
+            return false;
+          }
+          value = X;
+        }
+        else if (!order_[i]->evaluate(workspace.values_[dependency], value)) {
+          spdlog::error("Node {0} does not support evaluate", order_[i]->GetId());
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /**
+     * @brief Propagates the gradient of the output to all the nodes. The
+     *        gradients are reset before the pass.
+     * 
+     * @details It requires a forward pass. If the graph has been modified
+     *          since it was compiled, it is compiled again and the forward
+     *          pass is performed first.
+     */
+    void backward()
+    {
+      if (!compiled_) {
+        compile(output_);
+        if (!compiled_)
+          return;
+        forward();
+      }
+      const Eigen::Index Nout = output_->GetOutSize();
+      const Eigen::Index rows = Nout * output_->GetBatchSize();
+      for (auto node : order_)
+        node->ZeroGradient(rows);
+
+      if (seed_.rows() != rows || seed_.cols() != Nout)
+        seed_ = GradMatrix::Identity(Nout, Nout).replicate(output_->GetBatchSize(), 1);
+      output_->AccumulateGradient(seed_);
+
+      for (auto node = order_.rbegin(); node != order_.rend(); node++) {
+        CG_PROFILE_NODE(**node, Pass::Backward);
+        (*node)->backward();
+      }
+    }
+
+    /**
+     * @brief Vector-Jacobian product, accumulated into the gradient arena
+     * 
+     * @param R contains the cotangents of the output, one column per sample
+     *        (e.g. the residuals of a least-squares fit)
+     * @return the gradient arena, to which `sum_b J_b^T R.col(b)` has been added
+     * 
+     * @details Same as `backward`, but the output is seeded with `R` instead
+     *          of the identity, so every node carries a single row per sample
+     *          and the Jacobian is never formed. It requires a forward pass
+     *          (see `backward` for a graph modified since its compilation).
+     *          The arena is not reset, see `ZeroGradients`.
+     */
+    Eigen::Map<GradVector> vjp(const Eigen::Ref<const GradMatrix>& R)
+    {
+      if (!compiled_) {
+        compile(output_);
+        if (!compiled_)
+          return GetGradients();
+        forward();
+      }
+      const Eigen::Index rows = output_->GetBatchSize();
+      for (auto node : order_)
+        node->ZeroGradient(rows);
+      output_->AccumulateGradient(R.transpose());
+
+      for (auto node = order_.rbegin(); node != order_.rend(); node++) {
+        CG_PROFILE_NODE(**node, Pass::Backward);
+        (*node)->backward();
+      }
+      for (auto node : order_) {
+        CG_PROFILE_NODE(*node, Pass::Gradient);
+        node->vjp();
+      }
+      return GetGradients();
+    }
+
+    /**
+     * @brief Assembles the Jacobian of the output with respect to all the
+     *        parameters. It requires a backward pass.
+     */
+    const GradMatrix& jacobian()
+    {
+      jacobian(J_);
+      return J_;
+    }
+
+    // Same as above, but the Jacobian is written into `J`, which can be a
+    // block of a larger matrix. It is assembled from the gradients of the
+    // last backward pass, so the graph must not have been modified since.
+    // Nothing is written if it has not been compiled again since then.
+    void jacobian(Eigen::Ref<GradMatrix> J)
+    {
+      if (!compiled_) {
+        spdlog::error("The graph must be compiled, and a backward pass performed, before the Jacobian");
+        return;
+      }
+      const Eigen::Index Nout = output_->GetOutSize();
+      for (size_t i = 0; i < order_.size(); i++) {
+        const size_t Npar = order_[i]->getParNumber();
+        if (Npar > 0) {
+          CG_PROFILE_NODE(*order_[i], Pass::Gradient);
+          order_[i]->gradient(J.block(0, offsets_[i], Nout, Npar));
+        }
+      }
+    }
+
+    /**
+     * @brief Jacobian-vector products, in forward mode
+     * 
+     * @param V contains the directions in parameter space, one column per
+     *        direction, with the parameters ordered as in the Jacobian
+     * @return the derivatives of the output along the directions. Column
+     *         `k * batch + b` is `J_b * V.col(k)`, with `J_b` the Jacobian
+     *         of the b-th sample. Empty if the graph cannot be compiled.
+     * 
+     * @details The forward pass and the tangent pass run together, node by
+     *          node, so the cost is about one forward pass per direction and
+     *          the Jacobian is never formed.
+     */
+    const GradMatrix& jvp(const Eigen::Ref<const GradMatrix>& V)
+    {
+      if (!compiled_) {
+        compile(output_);
+        if (!compiled_)
+          return J_;
+      }
+      follow_arena();
+      for (size_t i = 0; i < order_.size(); i++) {
+        order_[i]->update();
+        order_[i]->tangent(V.middleRows(offsets_[i], order_[i]->getParNumber()));
+      }
+      return output_->GetTangent();
+    }
+
+    const Matrix& GetOutput() { return output_->GetValue(); }
+    NodePtr GetOutputNode() const { return output_; }
+    // Null if the graph has less than `i + 1` inputs that are not constant
+    NodePtr GetInputNode(size_t i = 0) const { return i < inputs_.size() ? inputs_[i] : nullptr; }
+    const std::vector<NodePtr>& GetOrder() const { return order_; }
+    size_t getParNumber() const { return Npar_; }
+    // Position of the parameters of the i-th node (in execution order)
+    size_t GetOffset(size_t i) const { return offsets_[i]; }
+
+    // Parameters and gradients of all the nodes, as flat vectors. They can
+    // be modified in place, but not resized. The parameters are considered
+    // modified when the view is taken: if it is kept and written to later,
+    // call `TouchParameters`.
+    Eigen::Map<Vector> GetParameters()
+    {
+      follow_arena();
+      TouchParameters();
+      return {parameters_.get(), Eigen::Index(Npar_)};
+    }
+    Eigen::Map<GradVector> GetGradients() { return {gradients_.get(), Eigen::Index(Npar_)}; }
+
+    void ZeroGradients() { GetGradients().setZero(); }
+
+    // Signals that the parameters have been modified in place, so that the
+    // next forward pass recomputes the nodes that depend on them (in this
+    // graph and in its clones)
+    void TouchParameters()
+    {
+      for (auto node : order_)
+        node->TouchParameters();
+    }
+
+    // Buffer of the parameters, which can be shared with other graphs with
+    // the same architecture (see `BindParameters`)
+    const std::shared_ptr<Scalar>& GetParameterBuffer() const { return parameters_; }
+
+    /**
+     * @brief Points the parameters of all the nodes to `parameters`
+     * 
+     * @details Nothing is copied: the buffer must hold `getParNumber()`
+     *          values in the order of the arena, e.g. a snapshot mapped in
+     *          memory (see `Snapshot`), and it is kept alive by the graph.
+     *          The clones of the graph follow it, while the graph itself
+     *          stops following the graph it is a clone of (see `clone`).
+     */
+    void BindParameters(std::shared_ptr<Scalar> parameters)
+    {
+      if (!compiled_)
+        compile(output_);
+      bind_nodes(std::move(parameters));
+      arena_->parameters = parameters_;
+      source_.reset();
+    }
+
+    /**
+     * @brief Prints the profiling counters of the nodes, see `profiler.hpp`
+     * 
+     * @details Nodes with the same id are summed up. Rates are computed from
+     *          the estimated flops and bytes of each pass.
+     */
+    void ProfileReport(std::ostream& os = std::cout) const
+    {
+#ifndef CG_PROFILING
+      os << "Profiling is disabled, define CG_PROFILING to enable it" << std::endl;
+#endif
+      std::vector<std::string> ids;
+      std::unordered_map<std::string, std::array<PassCounters, 3>> counters;
+      for (auto node : order_) {
+        auto [entry, added] = counters.try_emplace(node->GetId());
+        if (added)
+          ids.push_back(node->GetId());
+        for (size_t p = 0; p < 3; p++)
+          entry->second[p] += node->GetCounters(Pass(p));
+      }
+
+      os << "node\tpass\tcalls\ttotal [ms]\tper call [ns]\tGFLOP/s\tGB/s" << std::endl;
+      for (const auto& id : ids)
+        for (size_t p = 0; p < 3; p++) {
+          const PassCounters& c = counters[id][p];
+          if (c.calls == 0)
+            continue;
+          os << id << "\t" << pass_name(Pass(p)) << "\t" << c.calls << "\t" << c.ns * 1e-6 << "\t"
+             << c.ns / c.calls << "\t" << c.flops / c.ns << "\t" << c.bytes / c.ns << std::endl;
+        }
+    }
+
+    void ResetCounters()
+    {
+      for (auto node : order_)
+        node->ResetCounters();
+    }
+
+  private:
+    /**
+     * @brief Arena of the parameters of a graph, as seen by its clones
+     * 
+     * @details `parameters` is the buffer the graph is bound to, and `size`
+     *          the number of parameters it holds.
+     */
+    struct Arena
+    {
+      std::shared_ptr<Scalar> parameters;
+      size_t size = 0;
+    };
+
+    // Same as above, but the parameters are stored in `parameters` if not
+    // null, e.g. the arena of the graph this one is a clone of
+    void compile(NodePtr output, std::shared_ptr<Scalar> parameters)
+    {
+      if (!output && nodes_.empty()) {
+        spdlog::error("The graph has no node to compile");
+        return;
+      }
+
+      // Position of the parameters of each node in the current arena
+      std::unordered_map<NodePtr, size_t> previous;
+      for (size_t i = 0; i < order_.size(); i++)
+        if (order_[i]->getParNumber() > 0)
+          previous[order_[i]] = offsets_[i];
+      const size_t previous_npar = Npar_;
+
+      output_ = output ? output : nodes_.back().get();
+      order_.clear();
+      inputs_.clear();
+      offsets_.clear();
+
+      // Iterative depth-first search, with nodes pushed in post-order
+      std::unordered_set<NodePtr> visited;
+      std::vector<std::pair<NodePtr, size_t>> stack {{output_, 0}};
+      visited.insert(output_);
+      while (!stack.empty()) {
+        auto& [node, next] = stack.back();
+        auto dependencies = node->GetDependencies();
+        if (next < dependencies.size()) {
+          NodePtr dep = dependencies[next++];
+          if (visited.insert(dep).second)
+            stack.push_back({dep, 0});
+        }
+        else {
+          order_.push_back(node);
+          stack.pop_back();
+        }
+      }
+
+      Npar_ = 0;
+      for (auto node : order_) {
+        if (node->GetDependencies().empty() && !node->IsConstant())
+          inputs_.push_back(node);
+        offsets_.push_back(Npar_);
+        Npar_ += node->getParNumber();
+      }
+      if (inputs_.empty())
+        spdlog::warn("The graph has no input that is not constant");
+
+      // The arena is kept if no parameter moves, so that the clones and the
+      // views on it stay valid
+      bool moved = !parameters_ || Npar_ != previous_npar;
+      for (size_t i = 0; i < order_.size() && !moved; i++)
+        if (order_[i]->getParNumber() > 0) {
+          const auto it = previous.find(order_[i]);
+          moved = it == previous.end() || it->second != offsets_[i];
+        }
+      if (!parameters && !moved)
+        parameters = parameters_;
+      // The old arena is kept alive until all the nodes have moved out of it
+      if (!parameters)
+        parameters = make_buffer<Scalar>(Npar_);
+      auto gradients = make_buffer<GradScalar>(Npar_);
+      for (size_t i = 0; i < order_.size(); i++)
+        if (order_[i]->getParNumber() > 0)
+          order_[i]->BindParameters(parameters, gradients, offsets_[i]);
+      parameters_ = std::move(parameters);
+      gradients_ = std::move(gradients);
+      arena_->parameters = parameters_;
+      arena_->size = Npar_;
+
+      J_.setZero(output_->GetOutSize(), Npar_);
+      compiled_ = true;
+      spdlog::info("Graph compiled with {0} nodes and {1} parameters", order_.size(), Npar_);
+    }
+
+    // Points the parameters of the nodes to `parameters`, without copying
+    void bind_nodes(std::shared_ptr<Scalar> parameters)
+    {
+      for (size_t i = 0; i < order_.size(); i++)
+        if (order_[i]->getParNumber() > 0)
+          order_[i]->BindParameters(parameters, gradients_, offsets_[i], false);
+      parameters_ = std::move(parameters);
+    }
+
+    // Binds the graph to the arena of the graph it is a clone of, if that
+    // has been bound to a new one since. False if the layouts do not match.
+    bool follow_arena()
+    {
+      if (!source_ || source_->parameters == parameters_)
+        return true;
+      if (source_->size != Npar_) {
+        spdlog::error("The graph this one is a clone of has {0} parameters instead of {1}", source_->size, Npar_);
+        return false;
+      }
+      bind_nodes(source_->parameters);
+      arena_->parameters = parameters_;
+      return true;
+    }
+
+    std::vector<std::unique_ptr<NodeType>> nodes_;
+    std::shared_ptr<GraphClock> clock_ = std::make_shared<GraphClock>();
+    std::shared_ptr<Arena> arena_ = std::make_shared<Arena>();
+    std::shared_ptr<const Arena> source_; // arena of the graph this is a clone of
+    std::shared_ptr<Scalar> parameters_;
+    std::shared_ptr<GradScalar> gradients_;
+    std::vector<NodePtr> order_;
+    std::vector<NodePtr> inputs_;
+    std::unordered_map<std::string, NodePtr> aliases_;
+    std::vector<size_t> offsets_;
+    NodePtr output_ = nullptr;
+    GradMatrix J_;
+    GradMatrix seed_;
+    size_t Npar_ = 0;
+    bool compiled_ = false;
+};
+
+using Graph = GraphTemplate<>;
+#endif
@@ -10,27 +10,54 @@
  * 
  * @tparam MatType 
  * @tparam EvaluationPolicy 
+ * 
+ * @details The functions are only known at runtime, so they cannot be
+ *          vectorised and the scalar `EigenPolicy` is kept as default.
  */
 
-template <typename MatType = Eigen::VectorXd,
+template <typename MatType = Eigen::MatrixXd,
           template <typename> class EvaluationPolicy = EigenPolicy>
 class CustomActTemplate
 { 
   public:
+    using Scalar = typename MatType::Scalar;
+
 
-    CustomActTemplate(std::function<double(const double& x)> func,
-                      std::function<double(const double& x)> dfunc)
-    : func_(func)
+    CustomActTemplate(std::function<Scalar(const Scalar& x)> func,
+                      std::function<Scalar(const Scalar& x)> dfunc)
+    : func_(func), dfunc_(dfunc)
     {}
     
-    double Evaluate(const double& x)
+    Scalar Evaluate(const Scalar& x) const
     {
       return func_(x);
     }
 
+    Scalar Derive(const Scalar& x)
+    {
+      return dfunc_(x);
+    }
+
     MatType Evaluate(const MatType& mat)
     {
-      return EvaluationPolicy<MatType>::eval_element_wise(mat, [this](const double& x){ return Evaluate(x); });
+      return EvaluationPolicy<MatType>::eval_element_wise(mat, [this](const Scalar& x){ return Evaluate(x); });
+    }
+
+    // It is used by concurrent inference (see `Node::evaluate`), so the
+    // function must be safe to call from several threads at once
+    void Evaluate(const MatType& mat, MatType& out) const
+    {
+      EvaluationPolicy<MatType>::eval_element_wise(mat, out, [this](const Scalar& x){ return Evaluate(x); });
+    }
+
+    MatType Derive(const MatType& mat)
+    {
+      return EvaluationPolicy<MatType>::eval_element_wise(mat, [this](const Scalar& x){ return Derive(x); });
+    }
+
+    void Derive(const MatType& mat, MatType& out)
+    {
+      EvaluationPolicy<MatType>::eval_element_wise(mat, out, [this](const Scalar& x){ return Derive(x); });
     }
 
     MatType operator()(const MatType& mat)
@@ -39,7 +66,8 @@ class CustomActTemplate
     }
 
   private:
-  std::function<double(const double& x)> func_;
+  std::function<Scalar(const Scalar& x)> func_;
+  std::function<Scalar(const Scalar& x)> dfunc_;
 };
 using CustomActivation = CustomActTemplate<>;
 #endif
\ No newline at end of file
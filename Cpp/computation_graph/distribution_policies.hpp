@@ -1,4 +1,7 @@
 #include "utils_distribution.hpp"
+#include "philox.hpp"
+#include <cmath>
+#include <numbers>
 
 #ifndef INCLUDE_DISTRIBUTION_POLICIES
 #define INCLUDE_DISTRIBUTION_POLICIES
@@ -63,6 +66,59 @@ class Unifrom
 };
 
 
+// With a counter-based generator the policies compute the number of a given
+// counter, instead of the next one, so they can be evaluated in any order
+// (see `RandomInit`). The Gaussian uses the Box-Muller transform.
+template <>
+class Gaussian<Philox4x32>
+{ 
+  public:
+  Gaussian(Philox4x32* generator,
+           const double& mean,
+           const double& var)
+  : mean_(mean), var_(var), generator_(generator)
+  { }
+
+  Gaussian(Philox4x32* generator)
+  : Gaussian(generator, 0.0, 1.0)
+  { }
+
+  double operator()(uint64_t counter) const
+  {
+    const auto [u, v] = generator_->Uniforms(counter);
+    return mean_ + var_ * std::sqrt(-2.0 * std::log(u)) * std::cos(2.0 * std::numbers::pi * v);
+  }
+
+  double mean_, var_;
+  Philox4x32* generator_;
+};
+
+
+template <>
+class Unifrom<Philox4x32>
+{ 
+  public:
+  Unifrom(Philox4x32* generator,
+          const double& max,
+          const double& min)
+  : max_(max), min_(min), generator_(generator)
+  { }
+
+  Unifrom(Philox4x32* generator)
+  : Unifrom(generator, -1.0, 1.0)
+  { }
+
+  // The first number of the pair is in (0, 1], the second in [0, 1)
+  double operator()(uint64_t counter) const
+  {
+    return min_ + (max_ - min_) * generator_->Uniforms(counter).second;
+  }
+
+  double max_, min_;
+  Philox4x32* generator_;
+};
+
+
 // TODO: implement API for custom distribution
 template <typename RNG>
 requires std::uniform_random_bit_generator<RNG>
@@ -0,0 +1,391 @@
+#include "./tanh.hpp"
+#include "./thread_pool.hpp"
+#include "./utils.hpp"
+#include "./distribution_policies.hpp"
+#include <eigen3/unsupported/Eigen/CXX11/Tensor>
+#include <memory>
+
+#ifndef INCLUDE_ENSEMBLE
+#define INCLUDE_ENSEMBLE
+
+/**
+ * @brief Ensemble of replicas of the same MLP, trained together
+ *
+ * @tparam ActivationPolicy is the activation of the hidden layers (and of
+ *         the output layer, if requested)
+ * @tparam P specifies the numeric types (see `Precision`)
+ *
+ * @details All the replicas share the architecture and see the same input
+ *          batch, but each one has its own parameters and its own targets
+ *          (e.g. Monte Carlo replicas of the data). The parameters of all the
+ *          replicas are stored in one flat buffer, layer by layer:
+ *          - the biases of a layer as an `out x R` matrix, one column per
+ *            replica,
+ *          - the weights of a layer as an `R x out x in` tensor, whose
+ *            replica slices are `out x in` matrices stored row by row, as in
+ *            the arena of a `Graph`.
+ *          The gradients have the same layout. The replicas are split over
+ *          a pool of threads. The input is the same for all of them, so the
+ *          weights of the first layer of the replicas of a worker, which are
+ *          contiguous, are a single `(n * out) x in` matrix, and the first
+ *          layer is one GEMM per worker in both passes. The other layers are
+ *          one GEMM per layer and replica. An optimizer step (see `SGD`,
+ *          `Adam`) is a single sweep over the whole buffer.
+ *
+ *          Replica `r` is equivalent to a graph made of `Linear` and
+ *          `Activation` nodes with the same architecture. Its parameters can
+ *          be copied from and to the arena of such a graph with
+ *          `GetReplica` and `SetReplica`.
+ */
+template <typename ActivationPolicy = Tanh, typename P = DoublePrecision>
+class EnsembleTemplate
+{
+  public:
+    using Scalar = typename P::Scalar;
+    using GradScalar = typename P::GradScalar;
+    using Matrix = typename P::Matrix;
+    using Vector = typename P::Vector;
+    using GradMatrix = typename P::GradMatrix;
+    using GradVector = typename P::GradVector;
+    using RowMatrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+    using GradRowMatrix = Eigen::Matrix<GradScalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+    using WeightTensor = Eigen::TensorMap<Eigen::Tensor<Scalar, 3, Eigen::RowMajor>>;
+
+    /**
+     * @param architecture are the sizes of the layers, input first
+     * @param replicas is the number of replicas. It must be positive, zero
+     *        is reported as an error and replaced by one.
+     * @param output_activation applies the activation to the output layer too
+     */
+    EnsembleTemplate(const std::vector<size_t>& architecture,
+                     size_t replicas,
+                     bool output_activation = false,
+                     size_t nthreads = std::max(1u, std::thread::hardware_concurrency()))
+    : architecture_(architecture),
+      R_(std::max(replicas, size_t(1))),
+      output_activation_(output_activation),
+      pool_(std::max(size_t(1), std::min(nthreads, R_)))
+    {
+      if (replicas == 0)
+        spdlog::error("An ensemble needs at least one replica, one is used");
+      Npar_ = 0;
+      for (size_t l = 0; l + 1 < architecture_.size(); l++) {
+        layer_offsets_.push_back(Npar_);
+        Npar_ += R_ * architecture_[l + 1] * (architecture_[l] + 1);
+      }
+      parameters_ = Vector::Zero(Npar_);
+      gradients_ = GradVector::Zero(Npar_);
+      replicas_.resize(R_);
+      chunks_.resize(pool_.size());
+      losses_.resize(R_);
+    }
+
+    size_t GetReplicaNumber() const { return R_; }
+    size_t GetLayerNumber() const { return architecture_.size() - 1; }
+    // Parameters of all the replicas
+    size_t getParNumber() const { return Npar_; }
+    // Parameters of a single replica
+    size_t getReplicaParNumber() const { return Npar_ / R_; }
+
+    Eigen::Map<Vector> GetParameters() { return {parameters_.data(), parameters_.size()}; }
+    Eigen::Map<GradVector> GetGradients() { return {gradients_.data(), gradients_.size()}; }
+
+    // Biases of layer `l` (from 0), one column per replica
+    Eigen::Map<Matrix> Biases(size_t l)
+    {
+      return {parameters_.data() + layer_offsets_[l], Eigen::Index(architecture_[l + 1]), Eigen::Index(R_)};
+    }
+
+    // Weights of layer `l` (from 0), with dimensions `R x out x in`
+    WeightTensor Weights(size_t l)
+    {
+      return WeightTensor(parameters_.data() + weights_offset(l),
+                          Eigen::Index(R_), Eigen::Index(architecture_[l + 1]), Eigen::Index(architecture_[l]));
+    }
+
+    // Weights of layer `l` of replica `r`
+    Eigen::Map<RowMatrix> Weights(size_t l, size_t r)
+    {
+      return weights(parameters_.data(), l, r);
+    }
+
+    template <template<typename> typename distribution = Gaussian, typename RNG, typename Tuple = std::tuple<double,double>>
+    void initialise_parameters(RNG* rng, const Tuple& t = Tuple(0.,1.))
+    {
+      // Same order of the random numbers as for a sequence of `Linear` nodes
+      for (size_t r = 0; r < R_; r++)
+        for (size_t l = 0; l < GetLayerNumber(); l++) {
+          Weights(l, r) = Matrix(RandomInit<distribution, Scalar>(architecture_[l + 1], architecture_[l], rng, t));
+          Biases(l).col(r) = RandomInit<distribution, Scalar>(architecture_[l + 1], rng, t);
+        }
+    }
+
+    // Same as above with a counter-based generator, the replicas being drawn
+    // by the workers of `pool`. The blocks of the generator are reserved in
+    // the same order, so the parameters do not depend on the number of
+    // workers.
+    template <template<typename> typename distribution = Gaussian, CounterBasedRNG RNG, typename Tuple = std::tuple<double,double>>
+    void initialise_parameters(RNG* rng, ThreadPool& pool, const Tuple& t = Tuple(0.,1.))
+    {
+      size_t replica_size = 0;
+      for (size_t l = 0; l < GetLayerNumber(); l++)
+        replica_size += architecture_[l + 1] * (architecture_[l] + 1);
+      const uint64_t first = rng->Reserve(R_ * replica_size);
+      pool.parallel_for(R_, [&](size_t, size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+          uint64_t block = first + r * replica_size;
+          for (size_t l = 0; l < GetLayerNumber(); l++) {
+            auto weights = Weights(l, r);
+            RandomFill<distribution>(weights, block, rng, t);
+            block += weights.size();
+            RandomFill<distribution>(Biases(l).col(r), block, rng, t);
+            block += architecture_[l + 1];
+          }
+        }
+      });
+    }
+
+    // Copies the parameters of replica `r` in the order of the arena of a
+    // `Graph` with the same architecture (see `Graph::GetParameters`)
+    void GetReplica(size_t r, Eigen::Ref<Vector> parameters)
+    {
+      size_t offset = 0;
+      for (size_t l = 0; l < GetLayerNumber(); l++) {
+        const size_t in = architecture_[l], out = architecture_[l + 1];
+        parameters.segment(offset, out) = Biases(l).col(r);
+        Eigen::Map<RowMatrix>(parameters.data() + offset + out, out, in) = Weights(l, r);
+        offset += out * (in + 1);
+      }
+    }
+
+    void SetReplica(size_t r, const Eigen::Ref<const Vector>& parameters)
+    {
+      size_t offset = 0;
+      for (size_t l = 0; l < GetLayerNumber(); l++) {
+        const size_t in = architecture_[l], out = architecture_[l + 1];
+        Biases(l).col(r) = parameters.segment(offset, out);
+        Weights(l, r) = Eigen::Map<const RowMatrix>(parameters.data() + offset + out, out, in);
+        offset += out * (in + 1);
+      }
+    }
+
+    /**
+     * @brief Evaluates all the replicas on the same batch
+     *
+     * @param X contains the inputs, one column per sample
+     */
+    void forward(const Matrix& X)
+    {
+      input_ = &X;
+      pool_.parallel_for(R_, [this](size_t w, size_t begin, size_t end) {
+        forward_replicas(chunks_[w], begin, end);
+      });
+    }
+
+    // Output of replica `r` of the last forward pass, one column per sample
+    Eigen::Ref<const Matrix> GetOutput(size_t r) const { return value(GetLayerNumber() - 1, r); }
+
+    /**
+     * @brief Computes the gradient of the loss of every replica
+     *
+     * @param Y contains the targets of all the replicas, `out x (R * batch)`:
+     *        the columns of replica `r` start at `r * batch`
+     * @return the loss `|f - y|^2 / (2 * batch)` of each replica
+     *
+     * @details The gradients are written (not accumulated) in the gradient
+     *          buffer. It requires a forward pass.
+     */
+    const GradVector& backward(const Matrix& Y)
+    {
+      target_ = &Y;
+      pool_.parallel_for(R_, [this](size_t w, size_t begin, size_t end) {
+        backward_replicas(chunks_[w], begin, end);
+      });
+      return losses_;
+    }
+
+    /**
+     * @brief Forward, backward and optimizer update for all the replicas
+     *
+     * @param optimizer must have been initialised with `getParNumber()`
+     */
+    template <typename Optimizer>
+    const GradVector& step(const Matrix& X, const Matrix& Y, Optimizer& optimizer)
+    {
+      forward(X);
+      backward(Y);
+      optimizer.begin_step();
+      auto parameters = GetParameters();
+      auto gradients = GetGradients();
+      pool_.parallel_for(Npar_, [&](size_t, size_t begin, size_t end) {
+        optimizer.update(parameters, gradients, begin, end);
+      });
+      return losses_;
+    }
+
+  private:
+    // Buffers of a replica, reused as long as the batch size does not change.
+    // Those of the first layer are in the chunk of the worker (see `Chunk`).
+    struct Replica {
+      std::vector<Matrix> linear;      // before the activation
+      std::vector<Matrix> values;      // after the activation
+      std::vector<Matrix> derivatives;
+      GradMatrix gradient;
+      GradMatrix next_gradient;
+      GradMatrix input;                // input of a layer, in mixed precision
+      size_t chunk = 0;                // worker of the last forward pass
+      Eigen::Index row = 0;            // first row in the chunk
+    };
+
+    // First layer of the replicas of a worker, stacked: the rows of replica
+    // `r` start at `(r - begin) * out`
+    struct Chunk {
+      Matrix linear;
+      Matrix values;
+      Matrix derivatives;
+      GradMatrix gradient;
+      GradMatrix input;
+    };
+
+    size_t weights_offset(size_t l) const { return layer_offsets_[l] + R_ * architecture_[l + 1]; }
+
+    template <typename S>
+    Eigen::Map<Eigen::Matrix<S, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> weights(S* buffer, size_t l, size_t r)
+    {
+      const size_t in = architecture_[l], out = architecture_[l + 1];
+      return {buffer + weights_offset(l) + r * out * in, Eigen::Index(out), Eigen::Index(in)};
+    }
+
+    // Weights of the first layer of replicas [begin, end), one on top of the other
+    template <typename S>
+    Eigen::Map<Eigen::Matrix<S, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> stacked_weights(S* buffer, size_t begin, size_t end)
+    {
+      const size_t in = architecture_[0], out = architecture_[1];
+      return {buffer + weights_offset(0) + begin * out * in, Eigen::Index((end - begin) * out), Eigen::Index(in)};
+    }
+
+    bool has_activation(size_t l) const { return output_activation_ || l + 1 < GetLayerNumber(); }
+
+    // Value of layer `l` of replica `r`, after the activation
+    Eigen::Ref<const Matrix> value(size_t l, size_t r) const
+    {
+      const Replica& replica = replicas_[r];
+      if (l > 0)
+        return replica.values[l];
+      return chunks_[replica.chunk].values.middleRows(replica.row, architecture_[1]);
+    }
+
+    void forward_replicas(Chunk& chunk, size_t begin, size_t end)
+    {
+      const size_t L = GetLayerNumber();
+      const Eigen::Index out = architecture_[1];
+
+      // First layer, one GEMM for all the replicas of the chunk
+      Matrix& z0 = has_activation(0) ? chunk.linear : chunk.values;
+      z0.noalias() = stacked_weights(parameters_.data(), begin, end) * (*input_);
+      for (size_t r = begin; r < end; r++) {
+        replicas_[r].chunk = &chunk - chunks_.data();
+        replicas_[r].row = (r - begin) * out;
+        z0.middleRows(replicas_[r].row, out).colwise() += Biases(0).col(r);
+      }
+      if (has_activation(0)) {
+        if constexpr (FusedDerivative<ActivationPolicy, Matrix>)
+          act_policy_.EvaluateAndDerive(z0, chunk.values, chunk.derivatives);
+        else {
+          chunk.values = act_policy_(z0);
+          act_policy_.Derive(z0, chunk.derivatives);
+        }
+      }
+
+      for (size_t r = begin; r < end; r++) {
+        Replica& replica = replicas_[r];
+        replica.linear.resize(L);
+        replica.values.resize(L);
+        replica.derivatives.resize(L);
+        for (size_t l = 1; l < L; l++) {
+          Matrix& z = has_activation(l) ? replica.linear[l] : replica.values[l];
+          z.noalias() = Weights(l, r) * value(l - 1, r);
+          z.colwise() += Biases(l).col(r);
+          if (!has_activation(l))
+            continue;
+          if constexpr (FusedDerivative<ActivationPolicy, Matrix>)
+            act_policy_.EvaluateAndDerive(z, replica.values[l], replica.derivatives[l]);
+          else {
+            replica.values[l] = act_policy_(z);
+            act_policy_.Derive(z, replica.derivatives[l]);
+          }
+        }
+      }
+    }
+
+    // Gradient with respect to the weights of layer `l`, for the gradient
+    // `G` of its output and its input `input`. In mixed precision the input
+    // is cast once, into `buffer`.
+    template <typename Weights>
+    void weights_gradient(Weights&& dW, const GradMatrix& G, const Eigen::Ref<const Matrix>& input, GradMatrix& buffer)
+    {
+      if constexpr (std::is_same_v<Scalar, GradScalar>)
+        dW.noalias() = G * input.transpose();
+      else {
+        buffer = input.template cast<GradScalar>();
+        dW.noalias() = G * buffer.transpose();
+      }
+    }
+
+    void backward_replicas(Chunk& chunk, size_t begin, size_t end)
+    {
+      const Eigen::Index batch = input_->cols();
+      const size_t L = GetLayerNumber();
+      const Eigen::Index out = architecture_[1];
+      chunk.gradient.resize((end - begin) * out, batch);
+
+      for (size_t r = begin; r < end; r++) {
+        Replica& replica = replicas_[r];
+        const auto y = target_->middleCols(r * batch, batch);
+
+        // Gradient of the loss with respect to the output
+        GradMatrix& G = replica.gradient;
+        G = (GetOutput(r) - y).template cast<GradScalar>();
+        losses_(r) = G.squaredNorm() / (2 * batch);
+        G /= batch;
+
+        for (size_t l = L; l-- > 1;) {
+          if (has_activation(l))
+            G.array() *= replica.derivatives[l].template cast<GradScalar>().array();
+          Eigen::Map<GradMatrix>(gradients_.data() + layer_offsets_[l], architecture_[l + 1], R_).col(r) = G.rowwise().sum();
+          weights_gradient(weights(gradients_.data(), l, r), G, value(l - 1, r), replica.input);
+          replica.next_gradient.noalias() = Weights(l, r).transpose().template cast<GradScalar>() * G;
+          std::swap(G, replica.next_gradient);
+        }
+
+        // First layer, stacked in the chunk
+        auto G0 = chunk.gradient.middleRows((r - begin) * out, out);
+        G0 = G;
+        if (has_activation(0))
+          G0.array() *= chunk.derivatives.middleRows((r - begin) * out, out).template cast<GradScalar>().array();
+        Eigen::Map<GradMatrix>(gradients_.data() + layer_offsets_[0], out, R_).col(r) = G0.rowwise().sum();
+      }
+
+      // One GEMM for the weights of the first layer of all the replicas
+      weights_gradient(stacked_weights(gradients_.data(), begin, end), chunk.gradient, *input_, chunk.input);
+    }
+
+    std::vector<size_t> architecture_;
+    size_t R_;
+    bool output_activation_;
+    size_t Npar_;
+    std::vector<size_t> layer_offsets_;
+    Vector parameters_;
+    GradVector gradients_;
+    std::vector<Replica> replicas_;
+    std::vector<Chunk> chunks_;
+    GradVector losses_;
+    const Matrix* input_ = nullptr;
+    const Matrix* target_ = nullptr;
+    ActivationPolicy act_policy_;
+    ThreadPool pool_;
+};
+
+template <typename ActivationPolicy = Tanh>
+using Ensemble = EnsembleTemplate<ActivationPolicy>;
+#endif
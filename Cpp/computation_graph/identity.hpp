@@ -3,11 +3,15 @@
 #ifndef INCLUDE_IDENTITY
 #define INCLUDE_IDENTITY
 
-template <typename MatType = Eigen::VectorXd>
+template <typename MatType = Eigen::MatrixXd>
 class IdentityTemplate
 { 
-  public:    
-    double Evaluate(const double& x)
+  public:
+    using Scalar = typename MatType::Scalar;
+    
+    static constexpr JacobianStructure jacobian_structure = JacobianStructure::Identity;
+
+    Scalar Evaluate(const Scalar& x)
     {
       return x;
     }
@@ -17,6 +21,11 @@ class IdentityTemplate
       return mat;
     }
 
+    void Evaluate(const MatType& mat, MatType& out) const
+    {
+      out = mat;
+    }
+
     MatType operator()(const MatType& mat)
     {
       return Evaluate(mat);
@@ -9,19 +9,40 @@
  * 
  * @todo This class should be revisited...
  */
-class Input : public Node
+template <typename P = DoublePrecision>
+class InputTemplate : public NodeTemplate<P>
 { 
   public:
-    Input(size_t&& size, VecDep&& dependencies = {}, std::string&& Id = std::string("input"))
-    : Node(std::forward<VecDep>(dependencies), std::forward<std::string>(Id))
+    using Base = NodeTemplate<P>;
+    using typename Base::VecDep;
+    using typename Base::GradMatrix;
+
+    InputTemplate(size_t&& size, VecDep&& dependencies = {}, std::string&& Id = std::string("input"))
+    : Base(std::forward<VecDep>(dependencies), std::forward<std::string>(Id))
     { 
       outSize_ = std::move(size);
     }
 
-    ~Input() {}
+    ~InputTemplate() {}
+
+    virtual Base* clone(VecDep&& dependencies) const override
+    {
+      InputTemplate* node = new InputTemplate(size_t(outSize_), std::move(dependencies), std::string(Id_));
+      // Constants are part of the model, so their values are copied
+      if (constant_) {
+        node->constant_ = true;
+        node->CopyValues(value_);
+      }
+      return node;
+    }
     
-    void forward() override { 
-      dirtyFlag_ = true; }
+    // The values are set from outside (see `setValues`)
+    void forward() override {}
+
+    // A constant input is not listed among the inputs of the graph, and the
+    // nodes depending only on constants can be folded (see `Graph::optimise`)
+    void SetConstant(bool constant = true) { constant_ = constant; }
+    bool IsConstant() const override { return constant_; }
 
     void dependency_rule() override {}
 
@@ -29,12 +50,18 @@ class Input : public Node
     // This must change, I don't like it
     void initialise(size_t row, bool force = false)
     {
-      SetGradient(Eigen::MatrixXd::Zero(row, outSize_));
+      this->SetGradient(GradMatrix::Zero(row, outSize_));
     }
 
   private:
+    using Base::value_;
+    using Base::outSize_;
+    using Base::Id_;
+
+    bool constant_ = false;
 
     //void backward() override {}
     //void gradient() override {}
 };
+using Input = InputTemplate<>;
 #endif
\ No newline at end of file
@@ -0,0 +1,245 @@
+#include "./computation_graph.hpp"
+#include "./thread_pool.hpp"
+#include <eigen3/Eigen/Cholesky>
+
+#ifndef INCLUDE_LEVENBERG_MARQUARDT
+#define INCLUDE_LEVENBERG_MARQUARDT
+
+/**
+ * @brief Levenberg-Marquardt least-squares fit of the parameters of a graph
+ *
+ * @details Minimises `sum_i |y_i - f(x_i)|^2` over the parameters of the
+ *          graph. The normal equations `(J^T J + lambda D) delta = J^T r`,
+ *          with `D` the diagonal of `J^T J`, are accumulated by streaming
+ *          over the data: every worker of the pool owns a clone of the graph
+ *          (see `Graph::clone`) and a block of `block_size` rows of the
+ *          Jacobian, which is added to its own copy of `J^T J` with a rank-k
+ *          update (lower triangle only) as soon as it is full. The stacked
+ *          Jacobian of the whole dataset is never stored.
+ *
+ *          The entries of `D` are bounded from below, so that parameters
+ *          with vanishing derivatives (e.g. behind a saturated unit) do not
+ *          make the damped system singular.
+ *
+ *          `J^T J` and `J^T r` are computed once per accepted step. When a
+ *          step is rejected only the damping changes, and the damped matrix
+ *          is factorised again into the same, preallocated, Cholesky
+ *          decomposition.
+ *
+ *          Gauss-Newton is obtained with `lambda = 0`; in that case a step
+ *          that does not decrease the chi2 ends the fit.
+ *
+ * @tparam P is the precision of the graph. The normal equations are solved
+ *         in `P::GradScalar`.
+ */
+template <typename P = DoublePrecision>
+class LevenbergMarquardtTemplate
+{
+  public:
+    using Graph = GraphTemplate<P>;
+    using Matrix = typename P::Matrix;
+    using GradScalar = typename P::GradScalar;
+    using GradMatrix = typename P::GradMatrix;
+    using GradVector = typename P::GradVector;
+
+    struct Options {
+      GradScalar lambda = 1e-3;      // initial damping
+      GradScalar lambda_up = 10;     // damping factor after a rejected step
+      GradScalar lambda_down = 10;   // damping factor after an accepted step
+      GradScalar lambda_max = 1e10;  // the fit stops above this damping
+      GradScalar min_diagonal = 1e-6; // lower bound of the entries of D
+      GradScalar tolerance = 1e-10;  // on the relative decrease of the chi2
+      size_t max_iterations = 100;
+      size_t block_size = 64;        // samples per rank-k update
+    };
+
+    LevenbergMarquardtTemplate(Graph& graph,
+                               const Options& options = Options(),
+                               size_t nthreads = std::max(1u, std::thread::hardware_concurrency()))
+    : graph_(graph),
+      options_(options),
+      lambda_(options.lambda),
+      pool_(nthreads)
+    {
+      Nout_ = graph.GetOutputNode()->GetOutSize();
+      Npar_ = graph.getParNumber();
+      for (size_t i = 0; i < pool_.size(); i++) {
+        workers_.push_back({graph.clone(),
+                            GradMatrix(options_.block_size * Nout_, Npar_),
+                            GradVector(options_.block_size * Nout_),
+                            GradMatrix::Zero(Npar_, Npar_),
+                            GradVector::Zero(Npar_),
+                            0});
+      }
+      JtJ_.resize(Npar_, Npar_);
+      Jtr_.resize(Npar_);
+      damped_.resize(Npar_, Npar_);
+      delta_.resize(Npar_);
+      backup_.resize(Npar_);
+      llt_ = Eigen::LLT<GradMatrix>(Npar_);
+    }
+
+    /**
+     * @brief Fits the parameters of the graph to the data
+     *
+     * @param X contains the inputs, one column per sample
+     * @param Y contains the targets, one column per sample
+     * @return the number of accepted steps
+     */
+    size_t fit(const Matrix& X, const Matrix& Y)
+    {
+      chi2_ = accumulate(X, Y);
+      size_t iteration = 0;
+      for (; iteration < options_.max_iterations; iteration++) {
+        const GradScalar previous = chi2_;
+        if (!step(X, Y))
+          break;
+        spdlog::debug("LM iteration {0}: chi2 = {1}, lambda = {2}", iteration, chi2_, lambda_);
+        if (previous - chi2_ <= options_.tolerance * previous)
+          break;
+        accumulate(X, Y);
+      }
+      spdlog::info("LM fit ended after {0} steps with chi2 = {1}", iteration, chi2_);
+      return iteration;
+    }
+
+    /**
+     * @brief Tries steps with increasing damping until the chi2 decreases
+     *
+     * @details It requires the normal equations at the current parameters
+     *          (see `accumulate`).
+     *
+     * @return false if no step decreases the chi2
+     */
+    bool step(const Matrix& X, const Matrix& Y)
+    {
+      auto parameters = graph_.GetParameters();
+      backup_ = parameters;
+      while (lambda_ <= options_.lambda_max) {
+        damped_.template triangularView<Eigen::Lower>() = JtJ_;
+        damped_.diagonal().array() += lambda_ * JtJ_.diagonal().array().max(options_.min_diagonal);
+        llt_.compute(damped_);
+        if (llt_.info() == Eigen::Success) {
+          delta_ = llt_.solve(Jtr_);
+          parameters += delta_.template cast<typename P::Scalar>();
+          graph_.TouchParameters();
+          const GradScalar chi2 = evaluate(X, Y);
+          if (chi2 < chi2_) {
+            chi2_ = chi2;
+            lambda_ /= options_.lambda_down;
+            return true;
+          }
+          parameters = backup_;
+          graph_.TouchParameters();
+        }
+        if (lambda_ == 0)
+          return false;
+        lambda_ *= options_.lambda_up;
+      }
+      return false;
+    }
+
+    /**
+     * @brief Accumulates `J^T J` and `J^T r` at the current parameters
+     *
+     * @return the chi2
+     */
+    GradScalar accumulate(const Matrix& X, const Matrix& Y)
+    {
+      // Workers with no samples are skipped by `parallel_for`, but they are
+      // still summed by `reduce`
+      for (auto& worker : workers_) {
+        worker.JtJ.setZero();
+        worker.Jtr.setZero();
+        worker.chi2 = 0;
+      }
+      pool_.parallel_for(X.cols(), [&](size_t w, size_t begin, size_t end) {
+        Worker& worker = workers_[w];
+        Graph& graph = *worker.graph;
+        for (size_t first = begin; first < end; first += options_.block_size) {
+          const size_t n = std::min(options_.block_size, end - first);
+          for (size_t i = 0; i < n; i++) {
+            graph.GetInputNode()->CopyValues(X.col(first + i));
+            graph.forward();
+            graph.backward();
+            graph.jacobian(worker.J.middleRows(i * Nout_, Nout_));
+            worker.r.segment(i * Nout_, Nout_) = (Y.col(first + i) - graph.GetOutput()).template cast<GradScalar>();
+          }
+          const auto J = worker.J.topRows(n * Nout_);
+          const auto r = worker.r.head(n * Nout_);
+          worker.JtJ.template selfadjointView<Eigen::Lower>().rankUpdate(J.transpose());
+          worker.Jtr.noalias() += J.transpose() * r;
+          worker.chi2 += r.squaredNorm();
+        }
+      });
+      return reduce();
+    }
+
+    // Chi2 at the current parameters, with a forward pass only
+    GradScalar evaluate(const Matrix& X, const Matrix& Y)
+    {
+      for (auto& worker : workers_)
+        worker.chi2 = 0;
+      pool_.parallel_for(X.cols(), [&](size_t w, size_t begin, size_t end) {
+        Worker& worker = workers_[w];
+        Graph& graph = *worker.graph;
+        for (size_t first = begin; first < end; first += options_.block_size) {
+          const size_t n = std::min(options_.block_size, end - first);
+          graph.GetInputNode()->CopyValues(X.middleCols(first, n));
+          graph.forward();
+          worker.chi2 += (Y.middleCols(first, n) - graph.GetOutput()).template cast<GradScalar>().squaredNorm();
+        }
+      });
+      GradScalar chi2 = 0;
+      for (const auto& worker : workers_)
+        chi2 += worker.chi2;
+      return chi2;
+    }
+
+    GradScalar GetChi2() const { return chi2_; }
+    GradScalar GetLambda() const { return lambda_; }
+    // Lower triangle of `J^T J` and `J^T r` of the last call to `accumulate`
+    const GradMatrix& GetJtJ() const { return JtJ_; }
+    const GradVector& GetJtr() const { return Jtr_; }
+
+  private:
+    struct Worker {
+      std::unique_ptr<Graph> graph;
+      GradMatrix J;      // block of rows of the Jacobian
+      GradVector r;      // residuals of the block
+      GradMatrix JtJ;
+      GradVector Jtr;
+      GradScalar chi2;
+    };
+
+    GradScalar reduce()
+    {
+      JtJ_.setZero();
+      Jtr_.setZero();
+      chi2_ = 0;
+      for (const auto& worker : workers_) {
+        JtJ_.template triangularView<Eigen::Lower>() += worker.JtJ;
+        Jtr_ += worker.Jtr;
+        chi2_ += worker.chi2;
+      }
+      return chi2_;
+    }
+
+    Graph& graph_;
+    Options options_;
+    GradScalar lambda_;
+    GradScalar chi2_ = 0;
+    ThreadPool pool_;
+    std::vector<Worker> workers_;
+    size_t Nout_;
+    size_t Npar_;
+    GradMatrix JtJ_;
+    GradVector Jtr_;
+    GradMatrix damped_;
+    GradVector delta_;
+    typename P::Vector backup_;
+    Eigen::LLT<GradMatrix> llt_;
+};
+
+using LevenbergMarquardt = LevenbergMarquardtTemplate<>;
+#endif
@@ -0,0 +1,130 @@
+#include "./linear_node.hpp"
+#include "utils.hpp"
+
+#ifndef INCLUDE_LINEAR_ACTIVATION_NODE
+#define INCLUDE_LINEAR_ACTIVATION_NODE
+
+/**
+ * @brief Linear layer followed by an element-wise activation, in one node
+ *
+ * @tparam ActivationPolicy implements the element-wise function
+ * @tparam P specifies the numeric types (see `Precision`)
+ *
+ * @details It is created by `Graph::optimise` in place of a `Linear` node
+ *          whose only consumer is an `Activation` node, and it takes the id
+ *          of the activation. The parameters are those of the linear node,
+ *          so it is still a `Linear` for the rest of the graph (arena,
+ *          Jacobian, snapshots).
+ *
+ *          The activation is applied in place on the output of the GEMM,
+ *          while it is still in cache, and its derivative is cached for the
+ *          backward pass. The backward pass scales the incoming gradient by
+ *          the derivative and then goes through the linear layer, so after
+ *          it `GetGradient` is the gradient with respect to the input of the
+ *          activation, which is what `gradient` and `vjp` of the linear
+ *          layer need.
+ */
+template <typename ActivationPolicy, typename P = DoublePrecision>
+class LinearActivationTemplate : public LinearTemplate<P>
+{
+  public:
+    using Base = LinearTemplate<P>;
+    using Node = NodeTemplate<P>;
+    using typename Base::VecDep;
+    using typename Base::Scalar;
+    using typename Base::GradScalar;
+    using typename Base::Matrix;
+    using typename Base::GradMatrix;
+
+    // Node with the parameters of `linear` (shared) and the dependencies
+    // `dependencies`, which must have the same sizes as those of `linear`
+    LinearActivationTemplate(const Base& linear,
+                             VecDep&& dependencies,
+                             std::string&& Id,
+                             const ActivationPolicy& act_policy = ActivationPolicy())
+    : Base(linear, std::move(dependencies), std::move(Id)),
+      act_policy_(act_policy)
+    {}
+
+    virtual Node* clone(VecDep&& dependencies) const override
+    {
+      return new LinearActivationTemplate(*this, std::move(dependencies), std::string(Id_), act_policy_);
+    }
+
+    virtual void forward() override
+    {
+      Base::forward();
+      if constexpr (identity)
+        return;
+      else if constexpr (FusedDerivative<ActivationPolicy, Matrix>)
+        act_policy_.EvaluateAndDerive(value_, value_, derivative_);
+      else {
+        act_policy_.Derive(value_, derivative_);
+        value_ = act_policy_(value_);
+      }
+    }
+
+    // The activation is applied in place, see `Node::evaluate`. It is
+    // supported by policies with a const `Evaluate(input, output)`.
+    virtual bool evaluate(const Matrix& input, Matrix& output) const override
+    {
+      if constexpr (identity)
+        return Base::evaluate(input, output);
+      else if constexpr (InPlaceEvaluation<ActivationPolicy, Matrix>) {
+        Base::evaluate(input, output);
+        act_policy_.Evaluate(output, output);
+        return true;
+      }
+      else
+        return false;
+    }
+
+    virtual void backward() override
+    {
+      if constexpr (!identity) {
+        const Eigen::Index batch = derivative_.cols();
+        const Eigen::Index rows = gradient_.rows() / batch;
+        for (Eigen::Index b = 0; b < batch; b++)
+          gradient_.middleRows(b * rows, rows).array().rowwise() *= derivative_.col(b).transpose().template cast<GradScalar>().array();
+      }
+      Base::backward();
+    }
+
+    virtual void tangent(const Eigen::Ref<const GradMatrix>& directions) override
+    {
+      Base::tangent(directions);
+      if constexpr (!identity) {
+        const Eigen::Index batch = derivative_.cols();
+        for (Eigen::Index k = 0; k < directions.cols(); k++)
+          tangent_.middleCols(k * batch, batch).array() *= derivative_.template cast<GradScalar>().array();
+      }
+    }
+
+    // Cost of the linear layer, plus the activation (one flop per element)
+    // and the scaling of the gradient
+    virtual Cost cost(Pass pass) const override
+    {
+      Cost cost = Base::cost(pass);
+      if constexpr (!identity) {
+        if (pass == Pass::Forward)
+          cost.flops += 2 * value_.size();
+        else if (pass == Pass::Backward) {
+          cost.flops += gradient_.size();
+          cost.bytes += sizeof(Scalar) * derivative_.size();
+        }
+      }
+      return cost;
+    }
+
+  private:
+    static constexpr bool identity = activation_structure<ActivationPolicy>() == JacobianStructure::Identity;
+
+    using Base::value_;
+    using Base::gradient_;
+    using Base::tangent_;
+    using Base::Id_;
+
+    ActivationPolicy act_policy_;
+    Matrix derivative_;
+};
+#endif
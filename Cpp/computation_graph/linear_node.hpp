@@ -2,10 +2,24 @@
 #include "distribution_policies.hpp"
 #include "utils.hpp"
 #include <eigen3/unsupported/Eigen/CXX11/Tensor>
+#include <memory>
 #ifndef INCLUDE_LINEAR_NODE
 #define INCLUDE_LINEAR_NODE
 
 /**
+ * @tparam P specifies the numeric types (see `Precision`). The parameters
+ *         are stored as `P::Scalar`, the Jacobian as `P::GradScalar`.
+ * 
+ * @details The parameters live in a flat buffer, biases first and then the
+ *          weights row by row, i.e. in the same order as in the Jacobian.
+ *          Weights and biases are `Eigen::Map` views on it, and the same
+ *          holds for their gradients. A standalone node owns its buffers;
+ *          once the node is part of a compiled graph the buffers are the
+ *          arena of the graph (see `BindParameters`).
+ * 
+ *          The buffers are held through shared pointers, so that the clones
+ *          of a node (see `clone`) share the same weights.
+ * 
  * @todo
  * - copy constructor
  * - move constructor
@@ -13,13 +27,26 @@
  * - ...
  * 
  */
-class Linear : public Node
+template <typename P = DoublePrecision>
+class LinearTemplate : public NodeTemplate<P>
 { 
   public:
-    Linear(size_t&& size, 
-           VecDep&& dependencies, 
-           std::string&& Id)
-    : Node(std::forward<VecDep>(dependencies), std::forward<std::string>(Id))
+    using Base = NodeTemplate<P>;
+    using typename Base::VecDep;
+    using typename Base::LocalJacobian;
+    using typename Base::Scalar;
+    using typename Base::GradScalar;
+    using typename Base::Matrix;
+    using typename Base::Vector;
+    using typename Base::GradMatrix;
+    using typename Base::GradVector;
+    using RowMatrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+    using GradRowMatrix = Eigen::Matrix<GradScalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+    LinearTemplate(size_t&& size, 
+                   VecDep&& dependencies, 
+                   std::string&& Id)
+    : Base(std::forward<VecDep>(dependencies), std::forward<std::string>(Id))
     {
       outSize_ = size;
       if (!dependencies_.empty()) {
@@ -29,54 +56,194 @@ class Linear : public Node
 
       number_of_biases = outSize_;
       number_of_weights = outSize_ * inSize_;
+
+      parameters_ = make_buffer<Scalar>(numberOfParameters_);
+      gradients_ = make_buffer<GradScalar>(numberOfParameters_);
+      map_buffers();
     }
 
-    virtual ~Linear() {}
+    virtual ~LinearTemplate() {}
+
+    // The clone shares the parameters with the original node, but it has
+    // its own gradients
+    virtual Base* clone(VecDep&& dependencies) const override
+    {
+      return new LinearTemplate(*this, std::move(dependencies), std::string(Id_));
+    }
     
     virtual void forward() override
     {
-      auto input = dependencies_[0]->GetValue();
-      value_ =  biases_ + weights_ * input; // MLP architecture
+      const auto& input = dependencies_[0]->GetValue();
+      // MLP architecture. The whole batch goes through a single GEMM
+      value_.noalias() = weights_ * input;
+      value_.colwise() += biases_;
     }
 
+    virtual bool evaluate(const Matrix& input, Matrix& output) const override
+    {
+      output.noalias() = weights_ * input;
+      output.colwise() += biases_;
+      return true;
+    }
 
     void dependency_rule() override {
       spdlog::warn("Dependency rule called for {0}, but not yet implemented", Id_);
     }
 
-    virtual void backward() override 
-    { 
-      // I need to use `SetGradient` and `GetGradient` because the getter method is const.
-      // This is a rather generic implementation of the backward pass, and I think that could
-      // be implemented in the base class. The part that is specific to the particular type of
-      // node (the linear node in this case) is `gradient * weight`
-      dependencies_[0]->SetGradient(dependencies_[0]->GetGradient()  + gradient_ * weights_);
+    // The backward pass is implemented in the base class. The part that is
+    // specific to the linear node is the product with the weights, which
+    // are shared by all the samples. Row-major weights are the transposed
+    // Jacobian in column-major order.
+    virtual LocalJacobian local_jacobian() override
+    {
+      return {JacobianStructure::Dense, {weights_.data(), Eigen::Index(inSize_), Eigen::Index(outSize_)}};
     }
 
-    // TODO: this part can be optimised.
-    // TODO: The Eigen::Block is needed if I want
-    //       to pass in the block of the matrix
-    virtual void gradient(Eigen::Block<Eigen::MatrixXd,-1,-1>&& g) override 
+    /**
+     * @brief Writes the derivatives with respect to the parameters into `g`
+     * 
+     * @details The parameters are ordered as biases first, then the weights
+     *          row by row. The Jacobian of the output of the node with respect
+     *          to them is `[I | I ⊗ x^T]`, so the block of the weights of the
+     *          i-th unit is just the outer product of the i-th column of the
+     *          gradient with the input. The Kronecker product is never
+     *          materialised.
+     * 
+     *          In batched mode the contributions of the samples are accumulated,
+     *          i.e. `g` is the derivative of the sum over the batch. Since the
+     *          gradient is stacked sample by sample, its i-th column can be seen
+     *          as a `rows x batch` matrix, and the sum over the batch becomes
+     *          a single product with the input.
+     */
+    virtual void gradient(Eigen::Ref<GradMatrix> g) override 
     {
       // This depends on the forward pass
-      Grad_.block(0, outSize_, outSize_, outSize_*inSize_) = makeRecursive(dependencies_[0]->GetValue(), 
-                                                                              Eigen::Index(outSize_), 
-                                                                              Eigen::Index(outSize_*inSize_));
-      g = gradient_ * Grad_;
+      const GradMatrix& input = this->GradInput();
+      const Eigen::Index batch = input.cols();
+      const Eigen::Index rows = gradient_.rows() / batch;
+      for (Eigen::Index i = 0; i < Eigen::Index(outSize_); i++) {
+        Eigen::Map<const GradMatrix> Gi(gradient_.col(i).data(), rows, batch);
+        g.col(i) = Gi.rowwise().sum();
+        // A single sample is a plain outer product, which avoids the overhead
+        // of the general matrix product for small layers
+        if (batch == 1)
+          g.middleCols(outSize_ + i * inSize_, inSize_).noalias() = Gi.col(0) * input.col(0).transpose();
+        else
+          g.middleCols(outSize_ + i * inSize_, inSize_).noalias() = Gi * input.transpose();
+      }
+    }
+
+    /**
+     * @brief Accumulates the gradient of the parameters, see `Node::vjp`
+     * 
+     * @details With one row of `gradient_` per sample, the sum over the batch
+     *          of the outer products in `gradient` is a single product, written
+     *          directly into the row-major view of the weights gradient.
+     */
+    virtual void vjp() override
+    {
+      const GradMatrix& input = this->GradInput();
+      biases_gradient_.noalias() += gradient_.colwise().sum().transpose();
+      weights_gradient_.noalias() += gradient_.transpose() * input.transpose();
+    }
+
+    /**
+     * @brief Tangent of the output, see `Node::tangent`
+     * 
+     * @details On top of the propagation of the tangent of the input, the
+     *          k-th direction `(db, dW)` contributes `dW * x + db`, where
+     *          `dW` is read in place from the row-major slice of `directions`.
+     */
+    virtual void tangent(const Eigen::Ref<const GradMatrix>& directions) override
+    {
+      Base::tangent(directions);
+      const GradMatrix& input = this->GradInput();
+      const Eigen::Index batch = input.cols();
+      for (Eigen::Index k = 0; k < directions.cols(); k++) {
+        Eigen::Map<const GradRowMatrix> dW(directions.col(k).data() + outSize_, outSize_, inSize_);
+        auto t = tangent_.middleCols(k * batch, batch);
+        t.noalias() += dW * input;
+        t.colwise() += directions.col(k).head(outSize_);
+      }
+    }
+
+    // Estimated work of the passes, see `Node::cost`. The gradient pass is
+    // either the Jacobian (one row per output and sample) or the vjp (one
+    // row per sample).
+    virtual Cost cost(Pass pass) const override
+    {
+      const double in = inSize_, out = outSize_, batch = value_.cols(), rows = gradient_.rows();
+      switch (pass) {
+        case Pass::Forward:
+          return {2 * in * out * batch, sizeof(Scalar) * (in * out + out + (in + out) * batch)};
+        case Pass::Backward:
+          return {2 * rows * in * out, sizeof(GradScalar) * rows * (out + 2 * in) + sizeof(Scalar) * in * out};
+        case Pass::Gradient:
+          return {2 * rows * in * out, sizeof(GradScalar) * (rows * out + rows / batch * numberOfParameters_) + sizeof(Scalar) * in * batch};
+      }
+      return {};
     }
 
-    void setWeights(const Eigen::MatrixXd& weights) 
+    // The parameters are views on the arena, so the shapes must match
+    // (`out x in` and `out`), otherwise nothing is set and false is returned
+    bool setWeights(const Matrix& weights) 
     {
+      if (size_t(weights.rows()) != outSize_ || size_t(weights.cols()) != inSize_) {
+        spdlog::error("{0}: weights of size {1} x {2} given, {3} x {4} expected", Id_, weights.rows(), weights.cols(), outSize_, inSize_);
+        return false;
+      }
       weights_ = weights;
+      TouchParameters();
+      return true;
     }
 
-    void setBiases(const Eigen::VectorXd& biases) 
+    bool setBiases(const Vector& biases) 
     {
+      if (size_t(biases.size()) != outSize_) {
+        spdlog::error("{0}: {1} biases given, {2} expected", Id_, biases.size(), outSize_);
+        return false;
+      }
       biases_ = biases;
+      TouchParameters();
+      return true;
+    }
+
+    // The version is shared with the clones, which see the same parameters
+    virtual uint64_t ParametersVersion() const override { return parameters_version_->load(std::memory_order_relaxed); }
+
+    virtual void TouchParameters() override
+    {
+      parameters_version_->fetch_add(1, std::memory_order_relaxed);
+      this->clock_->parameters->fetch_add(1, std::memory_order_relaxed);
     }
 
-    Eigen::MatrixXd GetWeights () const { return weights_; }
-    Eigen::VectorXd GetBiases() const { return biases_; }
+    Matrix GetWeights () const { return weights_; }
+    Vector GetBiases() const { return biases_; }
+
+    // Views on the parameters and on their gradients. They stay valid until
+    // the node is bound to another buffer (i.e. the graph is compiled again).
+    // The parameters are considered modified when the view is taken: if it
+    // is kept and written to later, call `TouchParameters`.
+    Eigen::Map<RowMatrix>& Weights() { TouchParameters(); return weights_; }
+    Eigen::Map<Vector>& Biases() { TouchParameters(); return biases_; }
+    Eigen::Map<GradRowMatrix>& WeightsGradient() { return weights_gradient_; }
+    Eigen::Map<GradVector>& BiasesGradient() { return biases_gradient_; }
+
+    virtual void BindParameters(const std::shared_ptr<Scalar>& parameters,
+                                const std::shared_ptr<GradScalar>& gradients,
+                                size_t offset,
+                                bool copy = true) override
+    {
+      if (copy && parameters.get() + offset != biases_.data())
+        Eigen::Map<Vector>(parameters.get() + offset, numberOfParameters_) = Eigen::Map<const Vector>(biases_.data(), numberOfParameters_);
+      if (copy && gradients.get() + offset != biases_gradient_.data())
+        Eigen::Map<GradVector>(gradients.get() + offset, numberOfParameters_) = Eigen::Map<const GradVector>(biases_gradient_.data(), numberOfParameters_);
+      parameters_ = parameters;
+      gradients_ = gradients;
+      offset_ = offset;
+      map_buffers();
+      TouchParameters();
+    }
 
     template <template<typename> typename distribution = Gaussian, typename RNG, typename ...Params>
     void initialise_parameters(RNG* rng, 
@@ -84,19 +251,37 @@ class Linear : public Node
                                bool force = false)
     {
       if (!initialisedParameters_ || force) {
-        weights_ = RandomInit<distribution>(outSize_, inSize_, rng, t);
-        biases_ = RandomInit<distribution>(outSize_, rng, t);
+        // The random numbers are drawn in column-major order, as for a
+        // plain matrix, so that a given seed gives the same weights
+        weights_ = Matrix(RandomInit<distribution, Scalar>(outSize_, inSize_, rng, t));
+        biases_ = RandomInit<distribution, Scalar>(outSize_, rng, t);
         initialisedParameters_ = true;
+        TouchParameters();
       }
     }
     
+    // Same as above with a counter-based generator, the elements being drawn
+    // by the workers of `pool`. The parameters are the same as those of the
+    // serial version for the same generator, whatever the number of workers.
+    template <template<typename> typename distribution = Gaussian, CounterBasedRNG RNG, typename ...Params>
+    void initialise_parameters(RNG* rng,
+                               ThreadPool& pool,
+                               const std::tuple<Params...>& t = std::tuple<double,double>(0.,1.),
+                               bool force = false)
+    {
+      if (!initialisedParameters_ || force) {
+        RandomFill<distribution>(weights_, rng->Reserve(weights_.size()), rng, t, &pool);
+        RandomFill<distribution>(biases_, rng->Reserve(biases_.size()), rng, t, &pool);
+        initialisedParameters_ = true;
+        TouchParameters();
+      }
+    }
+
     // Initialise flag missing
     void initialise_gradients(size_t row, bool force = false)
     { 
       if (!initialisedGradients_ || force) {
-        Grad_ = Eigen::MatrixXd::Zero(outSize_, outSize_*(inSize_ + 1) );
-        Grad_.block(0,0, outSize_, outSize_) = Eigen::MatrixXd::Identity(outSize_, outSize_);
-        SetGradient(Eigen::MatrixXd::Zero(row, outSize_));
+        this->SetGradient(GradMatrix::Zero(row, outSize_));
         initialisedGradients_ = true;
       }
     }
@@ -111,16 +296,55 @@ class Linear : public Node
       initialise_gradients(row, force);
     }
 
-    size_t getParNumber() const { return numberOfParameters_; }
+    size_t getParNumber() const override { return numberOfParameters_; }
     size_t number_of_weights;
     size_t number_of_biases;
 
+  protected:
+    // Node sharing the parameters of `other`, with its own gradients (see
+    // `clone`). It is also used to build nodes that extend a linear one.
+    // The parameters are reached through a pointer that aliases the ones of
+    // `other` and keeps its whole buffer alive, so the offset is 0 and the
+    // gradients only cover this node until it is bound to an arena.
+    LinearTemplate(const LinearTemplate& other, VecDep&& dependencies, std::string&& Id)
+    : LinearTemplate(size_t(other.outSize_), std::move(dependencies), std::move(Id))
+    {
+      parameters_ = std::shared_ptr<Scalar>(other.parameters_, other.parameters_.get() + other.offset_);
+      offset_ = 0;
+      map_buffers();
+      initialisedParameters_ = other.initialisedParameters_;
+      parameters_version_ = other.parameters_version_;
+    }
+
+    using Base::value_;
+    using Base::gradient_;
+    using Base::tangent_;
+    using Base::outSize_;
+    using Base::inSize_;
+    using Base::dependencies_;
+    using Base::Id_;
+
   private:
-    Eigen::MatrixXd weights_;
-    Eigen::VectorXd biases_;
-    Eigen::MatrixXd Grad_; // This is really an auxiliary matrix
+    // Points the views to the buffers, starting from `offset_`
+    void map_buffers()
+    {
+      new (&biases_) Eigen::Map<Vector>(parameters_.get() + offset_, outSize_);
+      new (&weights_) Eigen::Map<RowMatrix>(parameters_.get() + offset_ + outSize_, outSize_, inSize_);
+      new (&biases_gradient_) Eigen::Map<GradVector>(gradients_.get() + offset_, outSize_);
+      new (&weights_gradient_) Eigen::Map<GradRowMatrix>(gradients_.get() + offset_ + outSize_, outSize_, inSize_);
+    }
+
+    std::shared_ptr<Scalar> parameters_;
+    std::shared_ptr<GradScalar> gradients_;
+    std::shared_ptr<std::atomic<uint64_t>> parameters_version_ = std::make_shared<std::atomic<uint64_t>>(0);
+    size_t offset_ = 0;
+    Eigen::Map<RowMatrix> weights_ {nullptr, 0, 0};
+    Eigen::Map<Vector> biases_ {nullptr, 0};
+    Eigen::Map<GradRowMatrix> weights_gradient_ {nullptr, 0, 0};
+    Eigen::Map<GradVector> biases_gradient_ {nullptr, 0};
     bool initialisedGradients_ = false;
     bool initialisedParameters_ = false;
     size_t numberOfParameters_;
 };
+using Linear = LinearTemplate<>;
 #endif
@@ -1,4 +1,5 @@
 #include <functional>
+#include <type_traits>
 
 #ifndef INCLUDE_MAT_POLICIES
 #define INCLUDE_MAT_POLICIES
@@ -12,9 +13,51 @@ template <typename BaseEigen>
 struct EigenPolicy
 {
   static BaseEigen eval_element_wise(const BaseEigen& mat, 
-                       std::function<double(const double&)> func)
+                       std::function<typename BaseEigen::Scalar(const typename BaseEigen::Scalar&)> func)
   {
     return mat.unaryExpr(func);
   }
+
+  // Same as above, but the result is written into `out`. No allocation
+  // takes place if `out` has already the right size.
+  static void eval_element_wise(const BaseEigen& mat, 
+                                BaseEigen& out,
+                                std::function<typename BaseEigen::Scalar(const typename BaseEigen::Scalar&)> func)
+  {
+    out = mat.unaryExpr(func);
+  }
+};
+
+/**
+ * @brief Vectorised policy for element-wise operations on Eigen objects
+ * 
+ * @tparam BaseEigen 
+ * 
+ * @details The kernel is applied to the whole matrix seen as an Eigen array,
+ *          so it is inlined and Eigen evaluates it packet by packet (SIMD).
+ *          This requires a kernel that accepts Eigen arrays, e.g. a generic
+ *          lambda written in terms of array operations. Kernels that only
+ *          accept scalars are still applied element-wise, but they are
+ *          inlined as no `std::function` is involved.
+ */
+template <typename BaseEigen>
+struct EigenArrayPolicy
+{
+  template <typename Kernel>
+  static BaseEigen eval_element_wise(const BaseEigen& mat, Kernel&& kernel)
+  {
+    BaseEigen out;
+    eval_element_wise(mat, out, std::forward<Kernel>(kernel));
+    return out;
+  }
+
+  template <typename Kernel>
+  static void eval_element_wise(const BaseEigen& mat, BaseEigen& out, Kernel&& kernel)
+  {
+    if constexpr (std::is_invocable_v<Kernel, decltype(mat.array())>)
+      out = kernel(mat.array()).matrix();
+    else
+      out = mat.unaryExpr(kernel);
+  }
 };
 #endif
\ No newline at end of file
@@ -5,73 +5,506 @@
 #include "spdlog/spdlog.h"
 #include <iostream>
 #include <any>
+#include <memory>
+#include "precision.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
 
 #ifndef INCLUDE_NODE
 #define INCLUDE_NODE
 
+/**
+ * @brief Structure of the local Jacobian of a node, i.e. the derivative of
+ *        its value with respect to the value of its dependency
+ */
+enum class JacobianStructure {
+  Identity, // nothing to multiply
+  Diagonal, // one column of diagonal entries per sample
+  Dense     // the same matrix for all the samples
+};
+
+/**
+ * @brief Zero-initialised buffer of `size` elements, owned by a shared pointer
+ * 
+ * @details Buffers of parameters are passed around as pointers to their
+ *          first element, so that memory not allocated by Eigen (e.g. a
+ *          mapped file) can be used in the same way.
+ */
+template <typename T>
+std::shared_ptr<T> make_buffer(size_t size)
+{
+  using Buffer = Eigen::Matrix<T, Eigen::Dynamic, 1>;
+  auto buffer = std::make_shared<Buffer>(Buffer::Zero(size));
+  return std::shared_ptr<T>(buffer, buffer->data());
+}
+
+/**
+ * @brief Clock of the changes of inputs and parameters seen by a graph
+ * 
+ * @details `inputs` is advanced every time the value of a node of the graph
+ *          is set from outside, and `parameters` every time some parameters
+ *          change. A node that has been validated at the current time is
+ *          known to be up to date without looking at its dependencies (see
+ *          `NodeTemplate::update`).
+ * 
+ *          Each graph has its own clock, shared by its nodes, so the graphs
+ *          used by different threads do not touch the same counter when
+ *          their inputs change. The parameters are shared with the clones of
+ *          the graph (see `Graph::clone`), and so is `parameters`, which is
+ *          only advanced when they are modified.
+ */
+struct GraphClock
+{
+  uint64_t inputs = 1;
+  std::shared_ptr<std::atomic<uint64_t>> parameters = std::make_shared<std::atomic<uint64_t>>(1);
+};
+
 /**
  * @brief Base Node class
  * 
- * It would be better to apply CRTP to the base class
+ * The passes are virtual calls, so that graphs can be put together at
+ * runtime. When the sequence of nodes is known at compile time, see
+ * `StaticGraph`, where the nodes are chained through CRTP instead.
+ * 
+ * @tparam P specifies the numeric types (see `Precision`)
+ * 
+ * @details Values are stored with one column per sample, so that a batch of
+ *          data points flows through the graph in a single pass. Gradients
+ *          are stacked sample by sample: the rows of `gradient_` are grouped
+ *          in blocks of `gradient_.rows() / GetBatchSize()`, one block per sample.
+ * 
+ *          Values are stored as `P::Scalar`, gradients as `P::GradScalar`.
+ * 
+ *          Tangents (forward mode, see `tangent`) have the shape of the value
+ *          repeated for each direction: column `k * batch + b` is the
+ *          derivative of the b-th sample along the k-th direction.
+ * 
+ *          Every node has a version, which is increased whenever its value
+ *          changes, and it remembers the versions of its dependencies (and
+ *          of its parameters) it was computed from. The value is recomputed
+ *          only if one of them changed (see `update`), so changing one input
+ *          only recomputes the nodes that depend on it.
  */
-class Node
+template <typename P = DoublePrecision>
+class NodeTemplate
 { 
   public:
-    using NodePtr = Node*;
+    using PrecisionType = P;
+    using Scalar = typename P::Scalar;
+    using GradScalar = typename P::GradScalar;
+    using Matrix = typename P::Matrix;
+    using Vector = typename P::Vector;
+    using GradMatrix = typename P::GradMatrix;
+    using GradVector = typename P::GradVector;
+    using NodePtr = NodeTemplate*;
     using VecDep = std::vector<NodePtr>;
 
-    Node(VecDep&& dependencies, std::string&& Id)
+    using ConstMatrixMap = Eigen::Map<const Matrix>;
+
+    /**
+     * @brief Local Jacobian, as a view on a buffer owned by the node
+     * 
+     * @details For `Diagonal` the view holds the diagonal entries, one column
+     *          per sample. For `Dense` it holds the transpose of the Jacobian
+     *          (`in x out`), which is the natural layout for weights stored
+     *          row by row.
+     */
+    struct LocalJacobian {
+      JacobianStructure structure;
+      ConstMatrixMap matrix {nullptr, 0, 0};
+    };
+
+    NodeTemplate(VecDep&& dependencies, std::string&& Id)
     : dependencies_(std::move(dependencies)), 
-      Id_(std::move(Id)),
-      dirtyFlag_(false)
+      Id_(std::move(Id))
     {/* do nothing */}
 
-    virtual ~Node() {};
+    virtual ~NodeTemplate() {};
+
+    /**
+     * @brief Creates a copy of the node connected to `dependencies`
+     * 
+     * @details The clone is meant to be lightweight: it does not copy values
+     *          and gradients, and nodes with parameters share them with the
+     *          original node.
+     */
+    virtual NodeTemplate* clone(VecDep&& dependencies) const = 0;
 
     virtual void forward() {};
 
-    virtual void backward() {};
+    /**
+     * @brief Stateless forward pass, for concurrent inference
+     * 
+     * @details Computes the value of the node for the value `input` of its
+     *          dependency, reading only the parameters: nothing in the node
+     *          is modified, so many threads can call it at once, each one
+     *          with its own buffers (see `Workspace`). `output` is resized
+     *          only if its shape is not the right one.
+     * 
+     * @return false if the node does not support it
+     */
+    virtual bool evaluate(const Matrix& input, Matrix& output) const { return false; }
+
+    /**
+     * @brief Generic backward pass for nodes with a single dependency
+     * 
+     * @details The node only declares its local Jacobian (see `local_jacobian`),
+     *          and the propagation is dispatched to the cheapest kernel for
+     *          that structure: a copy for the identity, a column scaling for
+     *          a diagonal, and a single product for a dense matrix.
+     *          In mixed precision the local Jacobian is cast to the type of
+     *          the gradient once per forward pass (see `GradJacobian`).
+     */
+    virtual void backward()
+    {
+      if (dependencies_.empty())
+        return;
+
+      const LocalJacobian jacobian = local_jacobian();
+      const Eigen::Map<const GradMatrix> matrix = GradJacobian(jacobian.matrix);
+      NodePtr dep = dependencies_[0];
+      dep->ReshapeGradient(gradient_.rows());
+      switch (jacobian.structure) {
+        case JacobianStructure::Identity:
+          dep->AccumulateGradient(gradient_);
+          break;
+        case JacobianStructure::Diagonal: {
+          // The diagonal changes from sample to sample
+          const Eigen::Index batch = matrix.cols();
+          const Eigen::Index rows = gradient_.rows() / batch;
+          for (Eigen::Index b = 0; b < batch; b++)
+            dep->AccumulateGradient(gradient_.middleRows(b * rows, rows) * matrix.col(b).asDiagonal(), b * rows);
+          break;
+        }
+        case JacobianStructure::Dense:
+          dep->AccumulateGradient(gradient_ * matrix.transpose());
+          break;
+      }
+    }
+
+    /**
+     * @brief Forward-mode counterpart of `backward`
+     * 
+     * @param directions are the rows of the parameters of this node in the
+     *        parameter directions, one column per direction (no rows if the
+     *        node has no parameters)
+     * 
+     * @details The tangent of the dependency is pushed through the local
+     *          Jacobian with the same kernels as in `backward`, applied from
+     *          the other side. Nodes with parameters add their own term. It
+     *          requires the forward pass of the node, and the tangent pass
+     *          of its dependency. Nodes without dependencies have zero tangent.
+     */
+    virtual void tangent(const Eigen::Ref<const GradMatrix>& directions)
+    {
+      if (dependencies_.empty()) {
+        tangent_.setZero(outSize_, directions.cols() * GetBatchSize());
+        return;
+      }
 
-    virtual void gradient(Eigen::Block<Eigen::MatrixXd,-1,-1>&& g) {};
+      const LocalJacobian jacobian = local_jacobian();
+      const Eigen::Map<const GradMatrix> matrix = GradJacobian(jacobian.matrix);
+      const GradMatrix& t = dependencies_[0]->GetTangent();
+      switch (jacobian.structure) {
+        case JacobianStructure::Identity:
+          tangent_ = t;
+          break;
+        case JacobianStructure::Diagonal: {
+          const Eigen::Index batch = matrix.cols();
+          tangent_.resize(outSize_, t.cols());
+          for (Eigen::Index k = 0; k < t.cols() / batch; k++)
+            tangent_.middleCols(k * batch, batch) = t.middleCols(k * batch, batch).cwiseProduct(matrix);
+          break;
+        }
+        case JacobianStructure::Dense:
+          tangent_.noalias() = matrix.transpose() * t;
+          break;
+      }
+    }
+
+    // Local Jacobian of the node. It is called during the backward pass, after
+    // the forward pass has been performed.
+    virtual LocalJacobian local_jacobian() { return {JacobianStructure::Identity}; }
+
+    // Derivatives with respect to the parameters of the node. `g` can be
+    // any block of a column-major matrix, e.g. a slice of the full Jacobian.
+    virtual void gradient(Eigen::Ref<GradMatrix> g) {};
+
+    // Adds the product of the gradient (one row per sample) with the
+    // derivatives with respect to the parameters to the gradients of the
+    // parameters (see `BindParameters`)
+    virtual void vjp() {}
 
     virtual void dependency_rule() {}
 
-    virtual void setValues(Eigen::VectorXd&& x)
+    /**
+     * @brief Estimated work of the last call to a pass (see `profiler.hpp`)
+     * 
+     * @details It is only used when the passes are profiled, and it is called
+     *          right after the pass, so the shapes of the buffers are those
+     *          of that call. Nodes that do not override it count as free.
+     */
+    virtual Cost cost(Pass pass) const { return {}; }
+
+    /**
+     * @brief Node computing this node and its dependency in one pass
+     * 
+     * @details Used by `Graph::optimise`. The new node is connected to the
+     *          dependencies of the dependency, and it is owned by the caller.
+     *          Null if the two nodes cannot be fused.
+     */
+    virtual NodeTemplate* fuse() const { return nullptr; }
+
+    // Constant nodes never change their value, e.g. inputs fixed once and
+    // for all (see `Graph::optimise`)
+    virtual bool IsConstant() const { return false; }
+
+    // Number of trainable parameters owned by the node
+    virtual size_t getParNumber() const { return 0; }
+
+    /**
+     * @brief Moves the parameters of the node into a shared buffer
+     * 
+     * @details The node keeps `parameters` and `gradients` alive, and from now
+     *          on its parameters and their gradients are views on the
+     *          `getParNumber()` entries starting at `offset`. If `copy` is
+     *          true, the current values are copied into the buffers, unless
+     *          the node is already bound to them; otherwise the values in the
+     *          buffers are used as they are (e.g. a snapshot mapped in
+     *          memory). See `Graph::compile`.
+     */
+    virtual void BindParameters(const std::shared_ptr<Scalar>& parameters,
+                                const std::shared_ptr<GradScalar>& gradients,
+                                size_t offset,
+                                bool copy = true) {}
+
+    // Version of the parameters of the node. It must change whenever the
+    // parameters are modified (see `TouchParameters`).
+    virtual uint64_t ParametersVersion() const { return 0; }
+
+    // Signals that the parameters have been modified in place
+    virtual void TouchParameters() {}
+
+    // Clock of the graph the node belongs to (see `Graph::add`)
+    void SetClock(const std::shared_ptr<GraphClock>& clock)
+    {
+      clock_ = clock;
+      checked_inputs_ = checked_parameters_ = 0;
+    }
+
+    /**
+     * @brief Brings the value up to date
+     * 
+     * @return the version of the value
+     * 
+     * @details The dependencies are updated first, and the forward pass runs
+     *          only if the node has never been computed, or if the version
+     *          of a dependency or of the parameters differs from the one the
+     *          value was computed from. Once validated, the node is not
+     *          checked again until the next change (see `GraphClock`), so
+     *          calling it repeatedly, e.g. through `GetValue`, is cheap.
+     */
+    uint64_t update()
+    {
+      const uint64_t inputs = clock_->inputs;
+      const uint64_t parameters = clock_->parameters->load(std::memory_order_relaxed);
+      if (checked_inputs_ == inputs && checked_parameters_ == parameters)
+        return version_;
+
+      bool stale = !computed_ || ParametersVersion() != seen_parameters_;
+      if (seen_.size() != dependencies_.size())
+        seen_.assign(dependencies_.size(), 0);
+      for (size_t i = 0; i < dependencies_.size(); i++) {
+        const uint64_t version = dependencies_[i]->update();
+        if (version != seen_[i]) {
+          seen_[i] = version;
+          stale = true;
+        }
+      }
+      if (stale)
+        Evaluate();
+      checked_inputs_ = inputs;
+      checked_parameters_ = parameters;
+      return version_;
+    }
+
+    /**
+     * @brief Runs the forward pass regardless of the cached value
+     * 
+     * @details It requires the dependencies to be up to date, see `update`.
+     */
+    void Evaluate()
+    {
+      {
+        CG_PROFILE_NODE(*this, Pass::Forward);
+        forward();
+      }
+      seen_parameters_ = ParametersVersion();
+      computed_ = true;
+      version_++;
+    }
+
+    // Marks the value as out of date, e.g. when some data used by the
+    // forward pass changes
+    void Invalidate()
+    {
+      computed_ = false;
+      clock_->inputs++;
+    }
+
+    virtual void setValues(Matrix&& x)
     { 
       value_ = std::move(x);
-      dirtyFlag_ = false;
+      set_externally();
+    }
+
+    void setValues(Vector&& x)
+    {
+      setValues(Matrix(std::move(x)));
+    }
+
+    // Copies the values into the existing buffer, which is not reallocated
+    // if the shape does not change
+    void CopyValues(const Eigen::Ref<const Matrix>& x)
+    {
+      value_ = x;
+      set_externally();
+    }
+
+    // Makes sure the gradient can hold `rows` stacked rows. The gradient is
+    // zeroed only if the shape changes (e.g. when the batch size changes).
+    void ReshapeGradient(Eigen::Index rows)
+    {
+      if (gradient_.rows() != rows || gradient_.cols() != Eigen::Index(outSize_))
+        gradient_.setZero(rows, outSize_);
     }
 
+    void ZeroGradient(Eigen::Index rows) { gradient_.setZero(rows, outSize_); }
+
     // Getters
     std::string GetId() const { return Id_; }
     size_t GetInSize() const { return inSize_; }
     size_t GetOutSize() const { return outSize_; }
-    Eigen::MatrixXd GetGradient() const { return gradient_; }
-    void SetGradient(Eigen::MatrixXd&& gradient) { this->gradient_ = gradient; }
+    size_t GetBatchSize() const { return value_.cols(); }
+    // Value and gradient are returned as read-only views, no copy is made
+    const GradMatrix& GetGradient() const { return gradient_; }
+    const GradMatrix& GetTangent() const { return tangent_; }
+    void SetGradient(GradMatrix&& gradient) { this->gradient_ = std::move(gradient); }
     VecDep GetDependencies() const { return dependencies_; }
-    const Eigen::VectorXd GetValue() 
+    // Connects the node to `replacement` in place of `dependency`, which
+    // must have the same size
+    void ReplaceDependency(NodePtr dependency, NodePtr replacement)
+    {
+      std::replace(dependencies_.begin(), dependencies_.end(), dependency, replacement);
+      Invalidate();
+    }
+    // Profiling counters, updated only if `CG_PROFILING` is defined
+    PassCounters& GetCounters(Pass pass) { return counters_[size_t(pass)]; }
+    const PassCounters& GetCounters(Pass pass) const { return counters_[size_t(pass)]; }
+    void ResetCounters() { counters_ = {}; }
+    uint64_t GetVersion() const { return version_; }
+    // The value is updated first, if needed (see `update`)
+    const Matrix& GetValue() 
     {  
-      if (dirtyFlag_)
-        return value_;
-      else {
-        forward();
-        dirtyFlag_ = true;
-        return value_;
-      } 
+      update();
+      return value_;
+    }
+
+    /**
+     * @brief Adds `g` in place to the stacked gradient, starting from `row`
+     * 
+     * @details The sum is evaluated directly into the gradient (`noalias`),
+     *          so passing a product expression such as `gradient_ * weights_`
+     *          does not create any temporary.
+     */
+    template <typename Derived>
+    void AccumulateGradient(const Eigen::MatrixBase<Derived>& g, Eigen::Index row = 0)
+    {
+      gradient_.middleRows(row, g.rows()).noalias() += g;
     }
 
   protected:
-    Eigen::VectorXd value_;
-    Eigen::MatrixXd gradient_;
+    Matrix value_;
+    GradMatrix gradient_;
+    GradMatrix tangent_;
     size_t outSize_;
     size_t inSize_;
     VecDep dependencies_;
     std::string Id_;
-    bool dirtyFlag_;
+    std::array<PassCounters, 3> counters_ {};
+    std::shared_ptr<GraphClock> clock_ = std::make_shared<GraphClock>();
+
+    /**
+     * @brief Value of the dependency in the type of the gradients
+     * 
+     * @details In mixed precision the value is cast into a buffer of the
+     *          node, once per version of the dependency, so the passes that
+     *          follow the same forward pass (backward, gradient, vjp and
+     *          tangent) share a single cast. Otherwise the value is returned
+     *          directly.
+     */
+    const GradMatrix& GradInput()
+    {
+      const Matrix& input = dependencies_[0]->GetValue();
+      if constexpr (std::is_same_v<Matrix, GradMatrix>)
+        return input;
+      else {
+        const uint64_t version = dependencies_[0]->GetVersion();
+        if (grad_input_source_ != dependencies_[0] || grad_input_version_ != version) {
+          grad_input_ = input.template cast<GradScalar>();
+          grad_input_source_ = dependencies_[0];
+          grad_input_version_ = version;
+        }
+        return grad_input_;
+      }
+    }
 
+    // Same as `GradInput` for the local Jacobian, which is cast once per
+    // version of the value of the node
+    Eigen::Map<const GradMatrix> GradJacobian(const ConstMatrixMap& matrix)
+    {
+      if constexpr (std::is_same_v<Matrix, GradMatrix>)
+        return matrix;
+      else {
+        if (grad_jacobian_version_ != version_) {
+          grad_jacobian_ = matrix.template cast<GradScalar>();
+          grad_jacobian_version_ = version_;
+        }
+        return {grad_jacobian_.data(), grad_jacobian_.rows(), grad_jacobian_.cols()};
+      }
+    }
+
+  private:
+    // The value has been given, not computed, e.g. for an input node
+    void set_externally()
+    {
+      seen_parameters_ = ParametersVersion();
+      computed_ = true;
+      version_++;
+      clock_->inputs++;
+    }
+
+    uint64_t version_ = 0;              // of the value
+    std::vector<uint64_t> seen_;        // versions of the dependencies
+    uint64_t seen_parameters_ = 0;      // version of the parameters
+    uint64_t checked_inputs_ = 0;       // clock of the last validation
+    uint64_t checked_parameters_ = 0;
+    bool computed_ = false;
+
+    // Casts of the input and of the local Jacobian, in mixed precision only
+    GradMatrix grad_input_;
+    NodePtr grad_input_source_ = nullptr;
+    uint64_t grad_input_version_ = 0;
+    GradMatrix grad_jacobian_;
+    uint64_t grad_jacobian_version_ = 0;
+
+  protected:
     enum NodeType {
       ExternalNode,
       InternalNode
     };
 };
+using Node = NodeTemplate<>;
 #endif
\ No newline at end of file
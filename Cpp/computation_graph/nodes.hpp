@@ -1,10 +1,23 @@
 #include "node.hpp"
 #include "linear_node.hpp"
+#include "linear_activation_node.hpp"
 #include "input_node.hpp"
 #include "activation_node.hpp"
+#include "chi2_node.hpp"
 #include "tanh.hpp"
 #include "identity.hpp"
 #include "custom_activation_function.hpp"
+#include "philox.hpp"
 #include "distribution_policies.hpp"
+#include "workspace.hpp"
+#include "computation_graph.hpp"
+#include "parallel_jacobian.hpp"
+#include "static_mlp.hpp"
+#include "static_graph.hpp"
+#include "levenberg_marquardt.hpp"
+#include "trainer.hpp"
+#include "ensemble.hpp"
+#include "snapshot.hpp"
+#include "profiler.hpp"
 
 //#include "./sigmpoid.hpp"
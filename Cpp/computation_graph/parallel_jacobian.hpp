@@ -0,0 +1,84 @@
+#include "./computation_graph.hpp"
+#include "./thread_pool.hpp"
+
+#ifndef INCLUDE_PARALLEL_JACOBIAN
+#define INCLUDE_PARALLEL_JACOBIAN
+
+/**
+ * @brief Parallel driver for the Jacobian of each data point of a dataset
+ * 
+ * @details Each worker of the pool owns a clone of the graph, which shares
+ *          the parameters with the original one (see `Graph::clone`). The
+ *          samples are split in contiguous chunks, and every worker runs
+ *          forward, backward and Jacobian passes on its own samples, writing
+ *          directly into the rows of the result that belong to them.
+ * 
+ *          The parameters must not be modified while `compute` is running.
+ */
+template <typename P = DoublePrecision>
+class ParallelJacobianTemplate
+{
+  public:
+    using Graph = GraphTemplate<P>;
+    using Matrix = typename P::Matrix;
+    using GradMatrix = typename P::GradMatrix;
+
+    ParallelJacobianTemplate(Graph& graph, size_t nthreads = std::max(1u, std::thread::hardware_concurrency()))
+    : pool_(nthreads)
+    {
+      for (size_t i = 0; i < pool_.size(); i++)
+        clones_.push_back(graph.clone());
+      Nin_ = graph.GetInputNode()->GetOutSize();
+      Nout_ = graph.GetOutputNode()->GetOutSize();
+      Npar_ = graph.getParNumber();
+    }
+
+    /**
+     * @brief Computes the Jacobian for each data point
+     * 
+     * @param X contains the data points, one column per sample
+     * @param J is a preallocated `(ndata * nout) x npar` matrix. The rows
+     *        [i * nout, (i + 1) * nout) contain the Jacobian of the i-th sample.
+     * @return false, and nothing is written, if `X` or `J` have the wrong size
+     */
+    bool compute(const Matrix& X, Eigen::Ref<GradMatrix> J)
+    {
+      if (size_t(X.rows()) != Nin_) {
+        spdlog::error("The data points have {0} components, but the input of the graph has {1}", X.rows(), Nin_);
+        return false;
+      }
+      if (size_t(J.rows()) != X.cols() * Nout_ || size_t(J.cols()) != Npar_) {
+        spdlog::error("The Jacobian is {0} x {1}, {2} x {3} expected", J.rows(), J.cols(), X.cols() * Nout_, Npar_);
+        return false;
+      }
+      pool_.parallel_for(X.cols(), [&](size_t worker, size_t begin, size_t end) {
+        Graph& graph = *clones_[worker];
+        for (size_t i = begin; i < end; i++) {
+          graph.GetInputNode()->CopyValues(X.col(i));
+          graph.forward();
+          graph.backward();
+          graph.jacobian(J.middleRows(i * Nout_, Nout_));
+        }
+      });
+      return true;
+    }
+
+    GradMatrix compute(const Matrix& X)
+    {
+      GradMatrix J(X.cols() * Nout_, Npar_);
+      compute(X, J);
+      return J;
+    }
+
+    size_t GetThreadNumber() const { return pool_.size(); }
+
+  private:
+    ThreadPool pool_;
+    std::vector<std::unique_ptr<Graph>> clones_;
+    size_t Nin_;
+    size_t Nout_;
+    size_t Npar_;
+};
+
+using ParallelJacobian = ParallelJacobianTemplate<>;
+#endif
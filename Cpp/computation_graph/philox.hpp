@@ -0,0 +1,119 @@
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <utility>
+
+#ifndef INCLUDE_PHILOX
+#define INCLUDE_PHILOX
+
+/**
+ * @brief Counter-based random number generator (Philox4x32-10)
+ *
+ * @details The numbers are a function of a key, given by the seed, and of a
+ *          counter: block `n` is the encryption of `n` with the key, and it
+ *          holds four 32-bit words (Salmon et al., "Parallel random numbers:
+ *          as easy as 1, 2, 3", SC11). Any block can be computed directly,
+ *          by any thread, so a matrix can be filled in any order and in
+ *          parallel with the same result.
+ *
+ *          The generator also keeps the position of the next unused block.
+ *          The distributions reserve a range of blocks for each matrix (see
+ *          `Reserve` and `RandomInit`), one block per element, so the
+ *          numbers of a given seed do not depend on the number of threads.
+ *          It satisfies `std::uniform_random_bit_generator` as well, and
+ *          it can then be used sequentially as any other engine.
+ *
+ *          The stream selects independent sequences for the same seed, e.g.
+ *          one per replica.
+ */
+class Philox4x32
+{
+  public:
+    using result_type = uint32_t;
+    using Block = std::array<uint32_t, 4>;
+
+    explicit Philox4x32(uint64_t seed = 0, uint64_t stream = 0)
+    : key_ {uint32_t(seed), uint32_t(seed >> 32)},
+      stream_ {uint32_t(stream), uint32_t(stream >> 32)}
+    {}
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    // Block `counter` of the stream. It does not change the generator.
+    Block operator()(uint64_t counter) const
+    {
+      Block c {uint32_t(counter), uint32_t(counter >> 32), stream_[0], stream_[1]};
+      std::array<uint32_t, 2> k = key_;
+      for (int round = 0; round < 10; round++) {
+        if (round > 0) {
+          k[0] += W0;
+          k[1] += W1;
+        }
+        const auto [hi0, lo0] = mulhilo(M0, c[0]);
+        const auto [hi1, lo1] = mulhilo(M1, c[2]);
+        c = {hi1 ^ c[1] ^ k[0], lo1, hi0 ^ c[3] ^ k[1], lo0};
+      }
+      return c;
+    }
+
+    // Two uniform numbers from block `counter`, with 53 random bits each.
+    // The first is in (0, 1], so that its logarithm is finite, and the
+    // second in [0, 1).
+    std::pair<double, double> Uniforms(uint64_t counter) const
+    {
+      const Block b = (*this)(counter);
+      const uint64_t x = (uint64_t(b[0]) << 32 | b[1]) >> 11;
+      const uint64_t y = (uint64_t(b[2]) << 32 | b[3]) >> 11;
+      return {double(x + 1) * 0x1p-53, double(y) * 0x1p-53};
+    }
+
+    // Sequential interface, four words per block
+    result_type operator()()
+    {
+      if (word_ == 4) {
+        buffer_ = (*this)(counter_++);
+        word_ = 0;
+      }
+      return buffer_[word_++];
+    }
+
+    // Reserves `n` blocks and returns the first one. The words left in the
+    // current block are discarded.
+    uint64_t Reserve(uint64_t n)
+    {
+      word_ = 4;
+      const uint64_t first = counter_;
+      counter_ += n;
+      return first;
+    }
+
+    uint64_t GetCounter() const { return counter_; }
+    void SetCounter(uint64_t counter) { counter_ = counter; word_ = 4; }
+
+  private:
+    static constexpr uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+    static constexpr uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+
+    static std::pair<uint32_t, uint32_t> mulhilo(uint32_t a, uint32_t b)
+    {
+      const uint64_t p = uint64_t(a) * b;
+      return {uint32_t(p >> 32), uint32_t(p)};
+    }
+
+    std::array<uint32_t, 2> key_;
+    std::array<uint32_t, 2> stream_;
+    uint64_t counter_ = 0;
+    Block buffer_ {};
+    int word_ = 4;
+};
+
+// Generators whose numbers can be computed from a counter (see `Philox4x32`)
+template <typename RNG>
+concept CounterBasedRNG = std::uniform_random_bit_generator<RNG> && requires (RNG g, const RNG cg, uint64_t n) {
+  { g.Reserve(n) } -> std::same_as<uint64_t>;
+  cg.Uniforms(n);
+};
+#endif
@@ -0,0 +1,28 @@
+#include <eigen3/Eigen/Eigen>
+
+#ifndef INCLUDE_PRECISION
+#define INCLUDE_PRECISION
+
+/**
+ * @brief Numeric types used by the nodes of a graph
+ * 
+ * @tparam Scalar_ is the type of values and parameters
+ * @tparam GradScalar_ is the type of gradients and Jacobians. It can be wider
+ *         than `Scalar_`, e.g. float values with gradients accumulated in
+ *         double (mixed precision).
+ */
+template <typename Scalar_ = double, typename GradScalar_ = Scalar_>
+struct Precision
+{
+  using Scalar = Scalar_;
+  using GradScalar = GradScalar_;
+  using Matrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+  using Vector = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+  using GradMatrix = Eigen::Matrix<GradScalar, Eigen::Dynamic, Eigen::Dynamic>;
+  using GradVector = Eigen::Matrix<GradScalar, Eigen::Dynamic, 1>;
+};
+
+using DoublePrecision = Precision<double>;
+using SinglePrecision = Precision<float>;
+using MixedPrecision = Precision<float, double>;
+#endif
@@ -0,0 +1,225 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef INCLUDE_PROFILER
+#define INCLUDE_PROFILER
+
+/**
+ * Instrumentation of the passes of the nodes.
+ *
+ * With `CG_PROFILING` defined (see the `CG_PROFILING` option in CMake) every
+ * forward, backward and gradient pass of a node is timed, and the node keeps
+ * the number of calls, the time spent and an estimate of the floating point
+ * operations and of the bytes moved (see `NodeTemplate::cost`). The counters
+ * are per node, so clones of a graph running in different threads do not
+ * share anything. `Graph::ProfileReport` prints them aggregated by node id.
+ *
+ * While a trace is being recorded (see `Trace`) every pass is also logged
+ * as an event, which can be exported in the Chrome trace format and opened
+ * in chrome://tracing or Perfetto, e.g. for a whole training step.
+ *
+ * Without `CG_PROFILING` the macros below expand to nothing, so there is no
+ * cost at all.
+ */
+
+enum class Pass {
+  Forward,
+  Backward,
+  Gradient // Jacobian and vector-Jacobian product of the parameters
+};
+
+constexpr const char* pass_name(Pass pass)
+{
+  switch (pass) {
+    case Pass::Forward: return "forward";
+    case Pass::Backward: return "backward";
+    case Pass::Gradient: return "gradient";
+  }
+  return "";
+}
+
+// Estimated work of a pass
+struct Cost {
+  double flops = 0;
+  double bytes = 0;
+};
+
+// Accumulated counters of a pass of a node
+struct PassCounters {
+  size_t calls = 0;
+  double ns = 0;
+  double flops = 0;
+  double bytes = 0;
+
+  PassCounters& operator+=(const PassCounters& other)
+  {
+    calls += other.calls;
+    ns += other.ns;
+    flops += other.flops;
+    bytes += other.bytes;
+    return *this;
+  }
+};
+
+/**
+ * @brief Recorder of trace events, in the Chrome trace format
+ *
+ * @details Each thread appends events to its own buffer, so recording does
+ *          not take any lock (only the first event of a thread does).
+ *          `write` must be called when no pass is running, typically after
+ *          `stop`.
+ */
+class Trace
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    static void start()
+    {
+      clear();
+      enabled_.store(true, std::memory_order_relaxed);
+    }
+
+    static void stop() { enabled_.store(false, std::memory_order_relaxed); }
+
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    static void clear()
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto& buffer : buffers_)
+        buffer->events.clear();
+      origin_ = Clock::now();
+    }
+
+    static void record(const std::string& name, const char* category,
+                       Clock::time_point start, Clock::time_point end, const Cost& cost = Cost())
+    {
+      buffer().events.push_back({name, category, (start - origin_).count(), (end - start).count(), cost});
+    }
+
+    // Writes the events of all the threads, with timestamps in microseconds
+    static bool write(const std::string& path)
+    {
+      std::ofstream file(path);
+      file << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+      bool first = true;
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto& buffer : buffers_)
+        for (const auto& event : buffer->events) {
+          file << (first ? "\n" : ",\n")
+               << "{\"name\": \"" << escape(event.name) << "\", \"cat\": \"" << event.category
+               << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << buffer->thread
+               << ", \"ts\": " << event.start * 1e-3 << ", \"dur\": " << event.duration * 1e-3
+               << ", \"args\": {\"flops\": " << event.cost.flops << ", \"bytes\": " << event.cost.bytes << "}}";
+          first = false;
+        }
+      file << "\n]}\n";
+      return bool(file);
+    }
+
+  private:
+    struct Event {
+      std::string name;
+      const char* category;
+      int64_t start;    // ns from the start of the trace
+      int64_t duration; // ns
+      Cost cost;
+    };
+
+    struct Buffer {
+      size_t thread;
+      std::vector<Event> events;
+    };
+
+    // Buffers are never released, so threads can come and go
+    static Buffer& buffer()
+    {
+      thread_local Buffer* buffer = []() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffers_.push_back(std::make_unique<Buffer>(Buffer{buffers_.size(), {}}));
+        return buffers_.back().get();
+      }();
+      return *buffer;
+    }
+
+    static std::string escape(const std::string& s)
+    {
+      std::string escaped;
+      for (char c : s) {
+        if (c == '"' || c == '\\')
+          escaped += '\\';
+        escaped += c;
+      }
+      return escaped;
+    }
+
+    static inline std::atomic<bool> enabled_ {false};
+    static inline std::mutex mutex_;
+    static inline std::vector<std::unique_ptr<Buffer>> buffers_;
+    static inline Clock::time_point origin_ = Clock::now();
+};
+
+/**
+ * @brief Times a pass of a node for the lifetime of the object
+ *
+ * @details The cost is estimated at the end of the pass, when the shapes of
+ *          values and gradients are known.
+ */
+template <typename Node>
+class ProfileScope
+{
+  public:
+    ProfileScope(Node& node, Pass pass) : node_(node), pass_(pass), start_(Trace::Clock::now()) {}
+
+    ~ProfileScope()
+    {
+      const auto end = Trace::Clock::now();
+      const Cost cost = node_.cost(pass_);
+      PassCounters& counters = node_.GetCounters(pass_);
+      counters.calls++;
+      counters.ns += std::chrono::duration<double, std::nano>(end - start_).count();
+      counters.flops += cost.flops;
+      counters.bytes += cost.bytes;
+      if (Trace::enabled())
+        Trace::record(node_.GetId(), pass_name(pass_), start_, end, cost);
+    }
+
+  private:
+    Node& node_;
+    Pass pass_;
+    Trace::Clock::time_point start_;
+};
+
+// Adds an event spanning a whole region, e.g. a training step, to the trace
+class TraceScope
+{
+  public:
+    TraceScope(const char* name) : name_(name), start_(Trace::Clock::now()) {}
+
+    ~TraceScope()
+    {
+      if (Trace::enabled())
+        Trace::record(name_, "step", start_, Trace::Clock::now());
+    }
+
+  private:
+    const char* name_;
+    Trace::Clock::time_point start_;
+};
+
+#ifdef CG_PROFILING
+#define CG_PROFILE_NODE(node, pass) ProfileScope<std::remove_reference_t<decltype(node)>> cg_profile_scope_(node, pass)
+#define CG_TRACE_SCOPE(name) TraceScope cg_trace_scope_(name)
+#else
+#define CG_PROFILE_NODE(node, pass)
+#define CG_TRACE_SCOPE(name)
+#endif
+
+#endif
@@ -0,0 +1,52 @@
+#include "./precision.hpp"
+
+#ifndef INCLUDE_SGD
+#define INCLUDE_SGD
+
+/**
+ * @brief Stochastic gradient descent with momentum
+ * 
+ * @details The optimizer works on the flat parameter and gradient buffers
+ *          of a graph (see `Graph::GetParameters`), and it is driven by a
+ *          `Trainer`. `update` only touches the entries in [begin, end), so
+ *          disjoint ranges can be updated concurrently.
+ * 
+ *          With velocity `v`, the update is `v = momentum * v - lr * g` and
+ *          `p += v`. The velocity is stored as `P::GradScalar`.
+ */
+template <typename P = DoublePrecision>
+class SGDTemplate
+{
+  public:
+    using PrecisionType = P;
+    using Vector = typename P::Vector;
+    using GradScalar = typename P::GradScalar;
+    using GradVector = typename P::GradVector;
+
+    SGDTemplate(GradScalar learning_rate = 1e-2, GradScalar momentum = 0.9)
+    : learning_rate_(learning_rate),
+      momentum_(momentum)
+    {}
+
+    void initialise(size_t npar) { velocity_.setZero(npar); }
+
+    // Called once per step, before the updates
+    void begin_step() {}
+
+    void update(Eigen::Map<Vector> parameters, Eigen::Map<GradVector> gradients, size_t begin, size_t end)
+    {
+      auto v = velocity_.segment(begin, end - begin);
+      v = momentum_ * v - learning_rate_ * gradients.segment(begin, end - begin);
+      parameters.segment(begin, end - begin) += v.template cast<typename P::Scalar>();
+    }
+
+    GradScalar GetLearningRate() const { return learning_rate_; }
+    void SetLearningRate(GradScalar learning_rate) { learning_rate_ = learning_rate; }
+
+  private:
+    GradScalar learning_rate_;
+    GradScalar momentum_;
+    GradVector velocity_;
+};
+using SGD = SGDTemplate<>;
+#endif
@@ -0,0 +1,223 @@
+#include "./computation_graph.hpp"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef INCLUDE_SNAPSHOT
+#define INCLUDE_SNAPSHOT
+
+/**
+ * @brief Binary snapshot of the parameters of a graph
+ *
+ * @details The file contains, in native byte order:
+ *          - a 64-byte header (`SnapshotHeader`),
+ *          - one `SnapshotLayer` entry per node with parameters, in execution
+ *            order, describing its position and shape,
+ *          - padding up to a multiple of 64 bytes,
+ *          - the parameters of each replica, one after the other, each one
+ *            in the order of the arena of the graph (see
+ *            `Graph::GetParameters`) and padded to a multiple of 64 bytes,
+ *            so that every replica is aligned.
+ *
+ *          `load` maps the file in memory (privately, so the parameters can
+ *          still be modified in place without touching the file), and
+ *          `bind` points the nodes of a graph directly at the parameters of
+ *          a replica, without copying them. The mapping is released when
+ *          the snapshot and all the graphs bound to it are gone.
+ *
+ *          The architecture itself is not rebuilt from the file: the graph
+ *          must be constructed in code, and `bind` checks that its nodes
+ *          match the layer table.
+ */
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t scalar_size;
+  uint64_t layers;
+  uint64_t parameters;    // per replica
+  uint64_t replicas;
+  uint64_t data_offset;   // from the start of the file, multiple of 64
+  uint64_t reserved[2];
+};
+static_assert(sizeof(SnapshotHeader) == 64);
+
+struct SnapshotLayer {
+  uint64_t offset;        // in the arena
+  uint64_t parameters;
+  uint64_t in;
+  uint64_t out;
+};
+
+template <typename P = DoublePrecision>
+class SnapshotTemplate
+{
+  public:
+    using Graph = GraphTemplate<P>;
+    using Scalar = typename P::Scalar;
+    using Matrix = typename P::Matrix;
+
+    static constexpr char magic[8] = {'C', 'G', 'S', 'N', 'A', 'P', '\0', '\0'};
+    static constexpr uint32_t version = 2;
+    static constexpr uint64_t alignment = 64;
+
+    // Saves the current parameters of the graph
+    static bool save(const std::string& path, Graph& graph)
+    {
+      return save(path, graph, graph.GetParameters());
+    }
+
+    /**
+     * @brief Saves several sets of parameters for the same architecture
+     *
+     * @param replicas contains the parameters, one column per replica, in
+     *        the order of the arena of `graph`
+     */
+    static bool save(const std::string& path, Graph& graph, const Eigen::Ref<const Matrix>& replicas)
+    {
+      const std::vector<SnapshotLayer> layers = layer_table(graph);
+      if (size_t(replicas.rows()) != graph.getParNumber()) {
+        spdlog::error("Snapshot {0}: {1} parameters per replica, but the graph has {2}", path, replicas.rows(), graph.getParNumber());
+        return false;
+      }
+
+      SnapshotHeader header {};
+      std::memcpy(header.magic, magic, sizeof(magic));
+      header.version = version;
+      header.scalar_size = sizeof(Scalar);
+      header.layers = layers.size();
+      header.parameters = replicas.rows();
+      header.replicas = replicas.cols();
+      header.data_offset = padded(sizeof(SnapshotHeader) + layers.size() * sizeof(SnapshotLayer));
+
+      std::ofstream file(path, std::ios::binary);
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      file.write(reinterpret_cast<const char*>(layers.data()), layers.size() * sizeof(SnapshotLayer));
+      const std::vector<char> padding(header.data_offset - sizeof(header) - layers.size() * sizeof(SnapshotLayer), 0);
+      file.write(padding.data(), padding.size());
+      const std::vector<char> replica_padding(stride(header.parameters) - header.parameters * sizeof(Scalar), 0);
+      for (Eigen::Index r = 0; r < replicas.cols(); r++) {
+        file.write(reinterpret_cast<const char*>(replicas.col(r).data()), replicas.rows() * sizeof(Scalar));
+        file.write(replica_padding.data(), replica_padding.size());
+      }
+      if (!file) {
+        spdlog::error("Snapshot {0} could not be written", path);
+        return false;
+      }
+      return true;
+    }
+
+    // Maps the file in memory and checks its header
+    bool load(const std::string& path)
+    {
+      const int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        spdlog::error("Snapshot {0} could not be opened", path);
+        return false;
+      }
+      struct stat st;
+      const bool ok = ::fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(SnapshotHeader);
+      void* address = ok ? ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+      ::close(fd);
+      if (address == MAP_FAILED) {
+        spdlog::error("Snapshot {0} could not be mapped", path);
+        return false;
+      }
+      const size_t size = st.st_size;
+      mapping_ = std::shared_ptr<char>(static_cast<char*>(address), [size](char* p) { ::munmap(p, size); });
+
+      header_ = *reinterpret_cast<const SnapshotHeader*>(mapping_.get());
+      if (std::memcmp(header_.magic, magic, sizeof(magic)) != 0 || header_.version != version) {
+        spdlog::error("{0} is not a snapshot of version {1}", path, version);
+        mapping_.reset();
+        return false;
+      }
+      if (header_.scalar_size != sizeof(Scalar)) {
+        spdlog::error("Snapshot {0} has {1}-byte scalars, {2} expected", path, header_.scalar_size, sizeof(Scalar));
+        mapping_.reset();
+        return false;
+      }
+      // The sizes are compared by division, so that a corrupt header cannot
+      // overflow them
+      const size_t max_layers = (size - sizeof(SnapshotHeader)) / sizeof(SnapshotLayer);
+      if (header_.layers > max_layers ||
+          header_.data_offset < sizeof(SnapshotHeader) + header_.layers * sizeof(SnapshotLayer) ||
+          header_.data_offset % alignment != 0 ||
+          header_.data_offset > size) {
+        spdlog::error("Snapshot {0} has an invalid layer table or data offset", path);
+        mapping_.reset();
+        return false;
+      }
+      if (header_.parameters > (std::numeric_limits<uint64_t>::max() - alignment) / sizeof(Scalar) ||
+          (header_.replicas > 0 && header_.parameters > 0 &&
+           header_.replicas > (size - header_.data_offset) / stride(header_.parameters))) {
+        spdlog::error("Snapshot {0} is truncated", path);
+        mapping_.reset();
+        return false;
+      }
+      return true;
+    }
+
+    size_t GetReplicaNumber() const { return mapping_ ? header_.replicas : 0; }
+    size_t getParNumber() const { return mapping_ ? header_.parameters : 0; }
+
+    // Parameters of replica `r`, pointing into the mapped file
+    std::shared_ptr<Scalar> GetReplica(size_t r) const
+    {
+      char* data = mapping_.get() + header_.data_offset + r * stride(header_.parameters);
+      return std::shared_ptr<Scalar>(mapping_, reinterpret_cast<Scalar*>(data));
+    }
+
+    Eigen::Map<const typename P::Vector> GetReplicaView(size_t r) const
+    {
+      return {GetReplica(r).get(), Eigen::Index(header_.parameters)};
+    }
+
+    /**
+     * @brief Points the parameters of `graph` to replica `r`, with no copy
+     *
+     * @return false if the graph does not match the layer table
+     */
+    bool bind(Graph& graph, size_t r = 0) const
+    {
+      if (!mapping_ || r >= header_.replicas) {
+        spdlog::error("Replica {0} not available in the snapshot", r);
+        return false;
+      }
+      const std::vector<SnapshotLayer> layers = layer_table(graph);
+      const auto* stored = reinterpret_cast<const SnapshotLayer*>(mapping_.get() + sizeof(SnapshotHeader));
+      if (layers.size() != header_.layers ||
+          graph.getParNumber() != header_.parameters ||
+          std::memcmp(layers.data(), stored, layers.size() * sizeof(SnapshotLayer)) != 0) {
+        spdlog::error("The architecture of the graph does not match the snapshot");
+        return false;
+      }
+      graph.BindParameters(GetReplica(r));
+      return true;
+    }
+
+  private:
+    static uint64_t padded(uint64_t size) { return (size + alignment - 1) / alignment * alignment; }
+    // Bytes between the starts of two replicas
+    static uint64_t stride(uint64_t parameters) { return padded(parameters * sizeof(Scalar)); }
+
+    static std::vector<SnapshotLayer> layer_table(Graph& graph)
+    {
+      std::vector<SnapshotLayer> layers;
+      const auto& order = graph.GetOrder();
+      for (size_t i = 0; i < order.size(); i++)
+        if (order[i]->getParNumber() > 0)
+          layers.push_back({graph.GetOffset(i), order[i]->getParNumber(), order[i]->GetInSize(), order[i]->GetOutSize()});
+      return layers;
+    }
+
+    std::shared_ptr<char> mapping_;
+    SnapshotHeader header_ {};
+};
+
+using Snapshot = SnapshotTemplate<>;
+#endif
@@ -0,0 +1,459 @@
+#include "./node.hpp"
+#include "./tanh.hpp"
+#include "./utils.hpp"
+#include "./distribution_policies.hpp"
+#include <tuple>
+#include <utility>
+
+#ifndef INCLUDE_STATIC_GRAPH
+#define INCLUDE_STATIC_GRAPH
+
+/**
+ * @brief Base class of the nodes of a `StaticGraph`
+ *
+ * @tparam Derived is the node class (CRTP)
+ * @tparam P specifies the numeric types (see `Precision`)
+ *
+ * @details The layout of values and gradients is the same as for
+ *          `NodeTemplate`: one column per sample for values, one block of
+ *          rows per sample for gradients. Nothing is virtual: the derived
+ *          class declares the structure of its local Jacobian as
+ *          `static constexpr JacobianStructure jacobian_structure`, and
+ *          `backward` picks the kernel at compile time. Depending on the
+ *          structure the derived class provides
+ *          - `Diagonal`: `derivative()`, one column of diagonal entries per
+ *            sample,
+ *          - `Dense`: `weights()`, the `out x in` Jacobian, shared by all the
+ *            samples.
+ *
+ *          Nodes with parameters also provide `getParNumber`,
+ *          `BindParameters`, `gradient` and `vjp`, with the same meaning as
+ *          for `Linear`.
+ */
+template <typename Derived, typename P = DoublePrecision>
+class StaticNode
+{
+  public:
+    using PrecisionType = P;
+    using Scalar = typename P::Scalar;
+    using GradScalar = typename P::GradScalar;
+    using Matrix = typename P::Matrix;
+    using Vector = typename P::Vector;
+    using GradMatrix = typename P::GradMatrix;
+    using GradVector = typename P::GradVector;
+
+    StaticNode(std::string&& Id) : Id_(std::move(Id)) {}
+
+    const std::string& GetId() const { return Id_; }
+    size_t GetInSize() const { return inSize_; }
+    size_t GetOutSize() const { return outSize_; }
+    const Matrix& GetValue() const { return value_; }
+    const GradMatrix& GetGradient() const { return gradient_; }
+    GradMatrix& GetGradient() { return gradient_; }
+
+    // Nodes without parameters
+    size_t getParNumber() const { return 0; }
+    void BindParameters(Scalar* parameters, GradScalar* gradients) {}
+    template <typename Input>
+    void gradient(Eigen::Ref<GradMatrix> g, const Input& input) {}
+    template <typename Input>
+    void vjp(const Input& input) {}
+
+    /**
+     * @brief Writes the gradient with respect to the input of the node
+     *
+     * @details Same kernels as `NodeTemplate::backward`, chosen at compile
+     *          time.
+     */
+    void backward(GradMatrix& input_gradient) const
+    {
+      constexpr JacobianStructure structure = Derived::jacobian_structure;
+      if constexpr (structure == JacobianStructure::Identity)
+        input_gradient = gradient_;
+      else if constexpr (structure == JacobianStructure::Diagonal) {
+        const auto& derivative = derived().derivative();
+        const Eigen::Index batch = derivative.cols();
+        const Eigen::Index rows = gradient_.rows() / batch;
+        input_gradient.resize(gradient_.rows(), inSize_);
+        for (Eigen::Index b = 0; b < batch; b++)
+          input_gradient.middleRows(b * rows, rows).noalias() = gradient_.middleRows(b * rows, rows) * derivative.col(b).template cast<GradScalar>().asDiagonal();
+      }
+      else
+        input_gradient.noalias() = gradient_ * derived().weights().template cast<GradScalar>();
+    }
+
+  protected:
+    // Called by the graph, with the size of the output of the previous node
+    void connect(size_t in)
+    {
+      inSize_ = in;
+      if (outSize_ == 0)
+        outSize_ = in;
+    }
+
+    const Derived& derived() const { return static_cast<const Derived&>(*this); }
+
+    template <typename... Nodes>
+    friend class StaticGraph;
+
+    Matrix value_;
+    GradMatrix gradient_;
+    size_t inSize_ = 0;
+    size_t outSize_ = 0;
+    std::string Id_;
+};
+
+/**
+ * @brief Fully connected layer of a `StaticGraph`
+ *
+ * @details Same as `Linear`: the parameters are views on the arena of the
+ *          graph, biases first and then the weights row by row, and the
+ *          random initialisation draws the same numbers for the same seed.
+ */
+template <typename P = DoublePrecision>
+class StaticLinearTemplate : public StaticNode<StaticLinearTemplate<P>, P>
+{
+  public:
+    using Base = StaticNode<StaticLinearTemplate<P>, P>;
+    using typename Base::Scalar;
+    using typename Base::GradScalar;
+    using typename Base::Matrix;
+    using typename Base::Vector;
+    using typename Base::GradMatrix;
+    using typename Base::GradVector;
+    using RowMatrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+    using GradRowMatrix = Eigen::Matrix<GradScalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+    static constexpr JacobianStructure jacobian_structure = JacobianStructure::Dense;
+
+    StaticLinearTemplate(size_t size, std::string&& Id) : Base(std::move(Id)) { outSize_ = size; }
+
+    template <typename Input>
+    void forward(const Input& input)
+    {
+      value_.noalias() = weights_ * input;
+      value_.colwise() += biases_;
+    }
+
+    // See `Linear::gradient`
+    template <typename Input>
+    void gradient(Eigen::Ref<GradMatrix> g, const Input& x)
+    {
+      const auto& input = grad_input(x);
+      const Eigen::Index batch = input.cols();
+      const Eigen::Index rows = gradient_.rows() / batch;
+      for (Eigen::Index i = 0; i < Eigen::Index(outSize_); i++) {
+        Eigen::Map<const GradMatrix> Gi(gradient_.col(i).data(), rows, batch);
+        g.col(i) = Gi.rowwise().sum();
+        if (batch == 1)
+          g.middleCols(outSize_ + i * inSize_, inSize_).noalias() = Gi.col(0) * input.col(0).transpose();
+        else
+          g.middleCols(outSize_ + i * inSize_, inSize_).noalias() = Gi * input.transpose();
+      }
+    }
+
+    // See `Linear::vjp`
+    template <typename Input>
+    void vjp(const Input& x)
+    {
+      const auto& input = grad_input(x);
+      biases_gradient_.noalias() += gradient_.colwise().sum().transpose();
+      weights_gradient_.noalias() += gradient_.transpose() * input.transpose();
+    }
+
+    size_t getParNumber() const { return outSize_ * (inSize_ + 1); }
+
+    void BindParameters(Scalar* parameters, GradScalar* gradients)
+    {
+      new (&biases_) Eigen::Map<Vector>(parameters, outSize_);
+      new (&weights_) Eigen::Map<RowMatrix>(parameters + outSize_, outSize_, inSize_);
+      new (&biases_gradient_) Eigen::Map<GradVector>(gradients, outSize_);
+      new (&weights_gradient_) Eigen::Map<GradRowMatrix>(gradients + outSize_, outSize_, inSize_);
+    }
+
+    template <template<typename> typename distribution = Gaussian, typename RNG, typename Tuple = std::tuple<double,double>>
+    void initialise_parameters(RNG* rng, const Tuple& t = Tuple(0.,1.))
+    {
+      weights_ = Matrix(RandomInit<distribution, Scalar>(outSize_, inSize_, rng, t));
+      biases_ = RandomInit<distribution, Scalar>(outSize_, rng, t);
+    }
+
+    // Same checks as `Linear::setWeights`, the parameters being views on
+    // the arena of the graph
+    bool setWeights(const Matrix& weights)
+    {
+      if (size_t(weights.rows()) != outSize_ || size_t(weights.cols()) != inSize_) {
+        spdlog::error("{0}: weights of size {1} x {2} given, {3} x {4} expected", this->GetId(), weights.rows(), weights.cols(), outSize_, inSize_);
+        return false;
+      }
+      weights_ = weights;
+      return true;
+    }
+
+    bool setBiases(const Vector& biases)
+    {
+      if (size_t(biases.size()) != outSize_) {
+        spdlog::error("{0}: {1} biases given, {2} expected", this->GetId(), biases.size(), outSize_);
+        return false;
+      }
+      biases_ = biases;
+      return true;
+    }
+
+    Eigen::Map<RowMatrix>& Weights() { return weights_; }
+    Eigen::Map<Vector>& Biases() { return biases_; }
+    const Eigen::Map<RowMatrix>& weights() const { return weights_; }
+
+  private:
+    using Base::value_;
+    using Base::gradient_;
+    using Base::outSize_;
+    using Base::inSize_;
+
+    // The input in the type of the gradients. In mixed precision it is cast
+    // once per pass into a buffer of the node, see `Node::GradInput`.
+    template <typename Input>
+    const auto& grad_input(const Input& x)
+    {
+      if constexpr (std::is_same_v<Scalar, GradScalar>)
+        return x;
+      else {
+        grad_input_ = x.template cast<GradScalar>();
+        return grad_input_;
+      }
+    }
+
+    Eigen::Map<RowMatrix> weights_ {nullptr, 0, 0};
+    Eigen::Map<Vector> biases_ {nullptr, 0};
+    Eigen::Map<GradRowMatrix> weights_gradient_ {nullptr, 0, 0};
+    Eigen::Map<GradVector> biases_gradient_ {nullptr, 0};
+    GradMatrix grad_input_;
+};
+using StaticLinear = StaticLinearTemplate<>;
+
+/**
+ * @brief Element-wise activation of a `StaticGraph`
+ *
+ * @details The derivative is computed in the forward pass, together with
+ *          the value if the policy allows it.
+ */
+template <typename ActivationPolicy, typename P = Precision<typename ActivationPolicy::Scalar>>
+requires Callable <ActivationPolicy, typename P::Matrix>
+class StaticActivation : public StaticNode<StaticActivation<ActivationPolicy, P>, P>
+{
+  public:
+    using Base = StaticNode<StaticActivation<ActivationPolicy, P>, P>;
+    using typename Base::Matrix;
+
+    static constexpr JacobianStructure jacobian_structure = activation_structure<ActivationPolicy>();
+
+    StaticActivation(std::string&& Id, const ActivationPolicy& act_policy = ActivationPolicy())
+    : Base(std::move(Id)),
+      act_policy_(act_policy)
+    {}
+
+    template <typename Input>
+    void forward(const Input& input)
+    {
+      if constexpr (FusedDerivative<ActivationPolicy, Matrix>)
+        act_policy_.EvaluateAndDerive(input, value_, derivative_);
+      else {
+        value_ = act_policy_(input);
+        if constexpr (jacobian_structure != JacobianStructure::Identity)
+          act_policy_.Derive(input, derivative_);
+      }
+    }
+
+    const Matrix& derivative() const { return derivative_; }
+
+  private:
+    using Base::value_;
+
+    ActivationPolicy act_policy_;
+    Matrix derivative_;
+};
+
+/**
+ * @brief Chain of nodes whose types are known at compile time
+ *
+ * @tparam Nodes are the node classes (see `StaticNode`), from the first
+ *         after the input to the output
+ *
+ * @details The nodes are stored by value in a `std::tuple`, node `I`
+ *          depends on node `I - 1` and the first one on the input. The
+ *          passes are unrolled over the tuple, so every call is resolved at
+ *          compile time and can be inlined: no virtual calls, no pointer
+ *          chasing, and `get<I>()` returns the node with its own type.
+ *
+ *          Sizes are still runtime values, and the results are the same as
+ *          for a `Graph` made of the equivalent nodes, including the order
+ *          of the parameters in the arena and in the Jacobian. For a
+ *          fixed-size MLP see `StaticMLP`; for architectures only known at
+ *          runtime, `Graph` remains the way to go.
+ *
+ *          Example:
+ *          @code
+ *          StaticGraph graph(3, StaticLinear(10, "layer 1"),
+ *                               StaticActivation<Tanh>("activation layer 1"),
+ *                               StaticLinear(1, "layer 2"));
+ *          @endcode
+ */
+template <typename... Nodes>
+class StaticGraph
+{
+  static_assert(sizeof...(Nodes) > 0, "At least one node is needed");
+
+  public:
+    using P = typename std::tuple_element_t<0, std::tuple<Nodes...>>::PrecisionType;
+    using Scalar = typename P::Scalar;
+    using GradScalar = typename P::GradScalar;
+    using Matrix = typename P::Matrix;
+    using Vector = typename P::Vector;
+    using GradMatrix = typename P::GradMatrix;
+    using GradVector = typename P::GradVector;
+
+    static constexpr size_t number_of_nodes = sizeof...(Nodes);
+
+    // The parameters are moved into the arena of the graph, and they are
+    // zero until they are set or initialised
+    StaticGraph(size_t input_size, Nodes&&... nodes)
+    : nodes_(std::move(nodes)...)
+    {
+      connect(input_size, indices());
+      parameters_ = Vector::Zero(Npar_);
+      gradients_ = GradVector::Zero(Npar_);
+      bind(indices());
+      J_.setZero(output().GetOutSize(), Npar_);
+    }
+
+    // Nodes point into the arena of the graph, so it cannot be copied
+    StaticGraph(const StaticGraph&) = delete;
+    StaticGraph& operator=(const StaticGraph&) = delete;
+
+    template <size_t I>
+    auto& get() { return std::get<I>(nodes_); }
+
+    template <size_t I>
+    const auto& get() const { return std::get<I>(nodes_); }
+
+    auto& output() { return get<number_of_nodes - 1>(); }
+
+    size_t getParNumber() const { return Npar_; }
+    Eigen::Map<Vector> GetParameters() { return {parameters_.data(), parameters_.size()}; }
+    Eigen::Map<GradVector> GetGradients() { return {gradients_.data(), gradients_.size()}; }
+    void ZeroGradients() { gradients_.setZero(); }
+
+    // Evaluates the graph on the inputs, one column per sample
+    const Matrix& forward(const Eigen::Ref<const Matrix>& X)
+    {
+      input_ = X;
+      forward(indices());
+      return output().GetValue();
+    }
+
+    const Matrix& GetOutput() { return output().GetValue(); }
+
+    // See `Graph::backward`
+    void backward()
+    {
+      const Eigen::Index Nout = output().GetOutSize();
+      const Eigen::Index batch = input_.cols();
+      if (seed_.rows() != Nout * batch)
+        seed_ = GradMatrix::Identity(Nout, Nout).replicate(batch, 1);
+      output().GetGradient() = seed_;
+      backward(indices());
+    }
+
+    // See `Graph::jacobian`
+    const GradMatrix& jacobian()
+    {
+      jacobian(J_);
+      return J_;
+    }
+
+    void jacobian(Eigen::Ref<GradMatrix> J) { jacobian(J, indices()); }
+
+    // See `Graph::vjp`
+    Eigen::Map<GradVector> vjp(const Eigen::Ref<const GradMatrix>& R)
+    {
+      output().GetGradient() = R.transpose();
+      backward(indices());
+      vjp(indices());
+      return GetGradients();
+    }
+
+  private:
+    using Indices = std::make_index_sequence<number_of_nodes>;
+    static constexpr Indices indices() { return {}; }
+
+    // Input of the I-th node
+    template <size_t I>
+    const Matrix& input() const
+    {
+      if constexpr (I == 0)
+        return input_;
+      else
+        return get<I - 1>().GetValue();
+    }
+
+    template <size_t... Is>
+    void connect(size_t input_size, std::index_sequence<Is...>)
+    {
+      size_t size = input_size;
+      ((get<Is>().connect(size), size = get<Is>().GetOutSize()), ...);
+      Npar_ = (get<Is>().getParNumber() + ...);
+    }
+
+    template <size_t... Is>
+    void bind(std::index_sequence<Is...>)
+    {
+      size_t offset = 0;
+      ((offsets_[Is] = offset,
+        get<Is>().BindParameters(parameters_.data() + offset, gradients_.data() + offset),
+        offset += get<Is>().getParNumber()), ...);
+    }
+
+    template <size_t... Is>
+    void forward(std::index_sequence<Is...>)
+    {
+      (get<Is>().forward(input<Is>()), ...);
+    }
+
+    // From the output back to the first node
+    template <size_t... Is>
+    void backward(std::index_sequence<Is...>)
+    {
+      (backward_node<number_of_nodes - 1 - Is>(), ...);
+    }
+
+    // The gradient with respect to the input of the graph is not needed
+    template <size_t I>
+    void backward_node()
+    {
+      if constexpr (I > 0)
+        get<I>().backward(get<I - 1>().GetGradient());
+    }
+
+    template <size_t... Is>
+    void jacobian(Eigen::Ref<GradMatrix> J, std::index_sequence<Is...>)
+    {
+      const Eigen::Index Nout = output().GetOutSize();
+      (get<Is>().gradient(J.block(0, offsets_[Is], Nout, get<Is>().getParNumber()), input<Is>()), ...);
+    }
+
+    template <size_t... Is>
+    void vjp(std::index_sequence<Is...>)
+    {
+      (get<Is>().vjp(input<Is>()), ...);
+    }
+
+    std::tuple<Nodes...> nodes_;
+    std::array<size_t, number_of_nodes> offsets_ {};
+    size_t Npar_ = 0;
+    Vector parameters_;
+    GradVector gradients_;
+    Matrix input_;
+    GradMatrix J_;
+    GradMatrix seed_;
+};
+#endif
@@ -0,0 +1,227 @@
+#include "tanh.hpp"
+#include "utils.hpp"
+#include "distribution_policies.hpp"
+#include <array>
+#include <limits>
+#include <tuple>
+#include <utility>
+
+#ifndef INCLUDE_STATIC_MLP
+#define INCLUDE_STATIC_MLP
+
+/**
+ * @brief Fully connected layer with sizes fixed at compile time
+ *
+ * @details Same semantics as a `Linear` node followed by an `Activation`
+ *          node, for a single sample. All the members are fixed-size Eigen
+ *          objects, so the layer lives wherever its owner lives.
+ */
+template <typename Scalar, template <typename> class ActivationTemplate, int In, int Out>
+struct StaticLayer
+{
+  using Weights = Eigen::Matrix<Scalar, Out, In>;
+  using Biases = Eigen::Matrix<Scalar, Out, 1>;
+  using Value = Eigen::Matrix<Scalar, Out, 1>;
+  using ActivationPolicy = ActivationTemplate<Value>;
+
+  static constexpr int in_size = In;
+  static constexpr int out_size = Out;
+  static constexpr int number_of_parameters = Out * (In + 1);
+
+  template <typename Input>
+  void forward(const Input& x)
+  {
+    linear.noalias() = weights * x;
+    linear += biases;
+    if constexpr (FusedDerivative<ActivationPolicy, Value>)
+      act_policy.EvaluateAndDerive(linear, value, derivative);
+    else {
+      value = act_policy.Evaluate(linear);
+      derivative = act_policy.Derive(linear);
+    }
+  }
+
+  Weights weights;
+  Biases biases;
+  Value linear;
+  Value value;
+  Value derivative;
+  ActivationPolicy act_policy;
+};
+
+/**
+ * @brief Multilayer perceptron whose architecture is fixed at compile time
+ *
+ * @tparam ActivationTemplate is the activation, as a template on the matrix
+ *         type (e.g. `TanhTemplate`). It is applied to every layer,
+ *         including the output one, as in `test_NNAD.cpp`.
+ * @tparam Scalar is the numeric type
+ * @tparam Sizes are the sizes of the layers, input first, e.g. `3, 2, 2, 1`
+ *
+ * @details This is the counterpart of a `Graph` made of `Linear` and
+ *          `Activation` nodes for small networks, where allocations and
+ *          virtual calls cost more than the arithmetic. Values, gradients and
+ *          the Jacobian are fixed-size Eigen objects: there is no heap
+ *          allocation, and the layers are unrolled at compile time.
+ *
+ *          The operations are the same as in the dynamic graph, in the same
+ *          order, and the parameters in the Jacobian are ordered in the same
+ *          way (layer by layer, biases first, then the weights row by row).
+ *          The results are not bitwise identical to those of the dynamic
+ *          graph: Eigen uses different product kernels for fixed and dynamic
+ *          sizes, which add up the terms in a different order. They agree
+ *          to within `tolerance` relative to the largest entry, which is
+ *          checked by `bench_static_mlp`.
+ *
+ *          Only one sample at a time is supported.
+ */
+template <template <typename> class ActivationTemplate, typename Scalar, int... Sizes>
+class StaticMLPTemplate
+{
+  static_assert(sizeof...(Sizes) > 1, "At least an input and an output layer are needed");
+
+  public:
+    static constexpr std::array<int, sizeof...(Sizes)> architecture {Sizes...};
+    static constexpr size_t number_of_layers = sizeof...(Sizes) - 1;
+    static constexpr int input_size = architecture.front();
+    static constexpr int output_size = architecture.back();
+
+  private:
+    template <size_t I>
+    using Layer = StaticLayer<Scalar, ActivationTemplate, architecture[I], architecture[I + 1]>;
+
+    template <size_t... Is>
+    static auto make_layers(std::index_sequence<Is...>) -> std::tuple<Layer<Is>...>;
+
+    template <size_t... Is>
+    static constexpr int count_parameters(std::index_sequence<Is...>)
+    {
+      return (Layer<Is>::number_of_parameters + ...);
+    }
+
+    using Layers = decltype(make_layers(std::make_index_sequence<number_of_layers>{}));
+
+  public:
+    static constexpr int number_of_parameters = count_parameters(std::make_index_sequence<number_of_layers>{});
+
+    // Largest relative difference from the dynamic graph
+    static constexpr Scalar tolerance = 1e3 * std::numeric_limits<Scalar>::epsilon();
+
+    using Input = Eigen::Matrix<Scalar, input_size, 1>;
+    using Output = Eigen::Matrix<Scalar, output_size, 1>;
+    using Jacobian = Eigen::Matrix<Scalar, output_size, number_of_parameters>;
+
+    template <size_t I>
+    using Weights = typename Layer<I>::Weights;
+    template <size_t I>
+    using Biases = typename Layer<I>::Biases;
+
+    // Layers are indexed from 0, i.e. `setWeights<0>` sets the weights of
+    // "layer 1" of the dynamic graph
+    template <size_t I, typename Derived>
+    void setWeights(const Eigen::MatrixBase<Derived>& weights) { std::get<I>(layers_).weights = weights; }
+
+    template <size_t I, typename Derived>
+    void setBiases(const Eigen::MatrixBase<Derived>& biases) { std::get<I>(layers_).biases = biases; }
+
+    template <size_t I>
+    const Weights<I>& GetWeights() const { return std::get<I>(layers_).weights; }
+
+    template <size_t I>
+    const Biases<I>& GetBiases() const { return std::get<I>(layers_).biases; }
+
+    template <template<typename> typename distribution = Gaussian, typename RNG, typename Tuple = std::tuple<double,double>>
+    void initialise_parameters(RNG* rng, const Tuple& t = Tuple(0.,1.))
+    {
+      initialise_parameters<distribution>(rng, t, std::make_index_sequence<number_of_layers>{});
+    }
+
+    const Output& Evaluate(const Input& x)
+    {
+      input_ = x;
+      forward<0>();
+      return GetOutput();
+    }
+
+    const Output& GetOutput() const { return std::get<number_of_layers - 1>(layers_).value; }
+
+    /**
+     * @brief Jacobian of the output with respect to the parameters
+     *
+     * @details It uses the values of the last call to `Evaluate`.
+     */
+    const Jacobian& jacobian()
+    {
+      // Gradient of the output with respect to the output of the last layer
+      constexpr size_t last = number_of_layers - 1;
+      backward<last>(Eigen::Matrix<Scalar, output_size, output_size>::Identity());
+      return J_;
+    }
+
+  private:
+    template <size_t I>
+    void forward()
+    {
+      if constexpr (I == 0)
+        std::get<0>(layers_).forward(input_);
+      else
+        std::get<I>(layers_).forward(std::get<I - 1>(layers_).value);
+      if constexpr (I + 1 < number_of_layers)
+        forward<I + 1>();
+    }
+
+    // Offset of the parameters of the I-th layer in the Jacobian
+    template <size_t I>
+    static constexpr int offset()
+    {
+      if constexpr (I == 0)
+        return 0;
+      else
+        return offset<I - 1>() + Layer<I - 1>::number_of_parameters;
+    }
+
+    /**
+     * @param G is the gradient of the output with respect to the output of
+     *        the I-th layer (after the activation)
+     */
+    template <size_t I, typename Gradient>
+    void backward(const Gradient& G)
+    {
+      auto& layer = std::get<I>(layers_);
+      constexpr int in = Layer<I>::in_size;
+      constexpr int out = Layer<I>::out_size;
+
+      // Through the activation, as the diagonal kernel of `Node::backward`
+      const Eigen::Matrix<Scalar, output_size, out> Gz = G * layer.derivative.asDiagonal();
+
+      // Parameters, as in `Linear::gradient`
+      constexpr int off = offset<I>();
+      J_.template middleCols<out>(off) = Gz;
+      for (int i = 0; i < out; i++) {
+        if constexpr (I == 0)
+          J_.template middleCols<in>(off + out + i * in).noalias() = Gz.col(i) * input_.transpose();
+        else
+          J_.template middleCols<in>(off + out + i * in).noalias() = Gz.col(i) * std::get<I - 1>(layers_).value.transpose();
+      }
+
+      if constexpr (I > 0) {
+        const Eigen::Matrix<Scalar, output_size, in> Gin = Gz * layer.weights;
+        backward<I - 1>(Gin);
+      }
+    }
+
+    template <template<typename> typename distribution, typename RNG, typename Tuple, size_t... Is>
+    void initialise_parameters(RNG* rng, const Tuple& t, std::index_sequence<Is...>)
+    {
+      ((std::get<Is>(layers_).weights = RandomInit<distribution, Scalar>(Layer<Is>::out_size, Layer<Is>::in_size, rng, t),
+        std::get<Is>(layers_).biases = RandomInit<distribution, Scalar>(Layer<Is>::out_size, rng, t)), ...);
+    }
+
+    Input input_;
+    Layers layers_;
+    Jacobian J_;
+};
+
+template <int... Sizes>
+using StaticMLP = StaticMLPTemplate<TanhTemplate, double, Sizes...>;
+#endif
@@ -53,32 +53,30 @@ int main()
                                        nnad::OutputFunction::ACTIVATION
                                       };
 
-  Input input(x.size());
-  input.setValues(to_eigen_vector(x));
-  std::unique_ptr<Node> layer1 (new Linear(arch[1], {&input}, "layer 1"));
-  std::unique_ptr<Node> layer1_act (new Activation<Tanh>({layer1.get()}, "activation layer 1"));
-  std::unique_ptr<Node> layer2 (new Linear(arch[2], {layer1_act.get()}, "layer 2"));
-  std::unique_ptr<Node> layer2_act (new Activation<Tanh>({layer2.get()}, "activation layer 2"));
-  std::unique_ptr<Node> layer3 (new Linear(arch[3], {layer2_act.get()}, "layer 3"));
-  std::unique_ptr<Node> output (new Activation<Tanh>({layer3.get()}, "output"));
-  input.initialise(output->GetOutSize(), false);
-  static_cast<Linear*> (layer1.get())->initialise_gradients( output->GetOutSize());
-  static_cast<Linear*> (layer2.get())->initialise_gradients( output->GetOutSize());
-  static_cast<Linear*> (layer3.get())->initialise_gradients( output->GetOutSize());
-  static_cast<Activation<Tanh>*> (layer1_act.get())->initialise_gradients( output->GetOutSize());
-  static_cast<Activation<Tanh>*> (layer2_act.get())->initialise_gradients( output->GetOutSize());
-  static_cast<Activation<Tanh>*> (output.get())->initialise_gradients( output->GetOutSize());
+  Graph graph;
+  auto input = graph.add(new Input(x.size()));
+  input->setValues(to_eigen_vector(x));
+  auto layer1 = graph.add(new Linear(arch[1], {input}, "layer 1"));
+  auto layer1_act = graph.add(new Activation<Tanh>({layer1}, "activation layer 1"));
+  auto layer2 = graph.add(new Linear(arch[2], {layer1_act}, "layer 2"));
+  auto layer2_act = graph.add(new Activation<Tanh>({layer2}, "activation layer 2"));
+  auto layer3 = graph.add(new Linear(arch[3], {layer2_act}, "layer 3"));
+  auto output = graph.add(new Activation<Tanh>({layer3}, "output"));
+  graph.compile(output);
+  layer1->initialise_gradients( output->GetOutSize());
+  layer2->initialise_gradients( output->GetOutSize());
+  layer3->initialise_gradients( output->GetOutSize());
   
-  static_cast<Linear*> (layer1.get())->setBiases(to_eigen_vector(nn.GetBiases(1)));
-  static_cast<Linear*> (layer1.get())->setWeights(to_eigen_matrix(nn.GetLinks(1)));
-  static_cast<Linear*> (layer2.get())->setBiases(to_eigen_vector(nn.GetBiases(2)));
-  static_cast<Linear*> (layer2.get())->setWeights(to_eigen_matrix(nn.GetLinks(2)));
-  static_cast<Linear*> (layer3.get())->setBiases(to_eigen_vector(nn.GetBiases(3)));
-  static_cast<Linear*> (layer3.get())->setWeights(to_eigen_matrix(nn.GetLinks(3)));
-
-  output->forward();
+  layer1->setBiases(to_eigen_vector(nn.GetBiases(1)));
+  layer1->setWeights(to_eigen_matrix(nn.GetLinks(1)));
+  layer2->setBiases(to_eigen_vector(nn.GetBiases(2)));
+  layer2->setWeights(to_eigen_matrix(nn.GetLinks(2)));
+  layer3->setBiases(to_eigen_vector(nn.GetBiases(3)));
+  layer3->setWeights(to_eigen_matrix(nn.GetLinks(3)));
+
+  graph.forward();
   spdlog::info("Printing the output:");
-  std::cout << output->GetValue() << std::endl;
+  std::cout << graph.GetOutput() << std::endl;
 
   spdlog::info("Printing NNAD result");
   auto eval = nn.Evaluate(x);
@@ -87,42 +85,8 @@ int main()
   std::cout << std::endl;
 
   spdlog::info("Check gradient...");
-
-  output->SetGradient(Eigen::MatrixXd::Identity(output->GetOutSize(), output->GetOutSize()));
-  output->backward();
-  layer3->backward();
-  layer2_act->backward();
-  layer2->backward();
-  layer1_act->backward();
-  layer1->backward();
-
-  size_t Npar = 0;
-  int Npar1 = static_cast<Linear*> (layer1.get())->getParNumber();
-  int Npar2 = static_cast<Linear*> (layer2.get())->getParNumber();
-  int Npar3 = static_cast<Linear*> (layer3.get())->getParNumber();
-  int Nb1 = static_cast<Linear*> (layer1.get())->number_of_biases;
-  int Nb2 = static_cast<Linear*> (layer2.get())->number_of_biases;
-  int Nb3 = static_cast<Linear*> (layer3.get())->number_of_biases;
-  int Nw1 = static_cast<Linear*> (layer1.get())->number_of_weights;
-  int Nw2 = static_cast<Linear*> (layer2.get())->number_of_weights;
-  int Nw3 = static_cast<Linear*> (layer3.get())->number_of_weights;
-  Npar += static_cast<Linear*> (layer1.get())->getParNumber();
-  Npar += static_cast<Linear*> (layer2.get())->getParNumber();
-  Npar += static_cast<Linear*> (layer3.get())->getParNumber();
-  Eigen::MatrixXd J = Eigen::MatrixXd::Zero(layer3->GetOutSize(), Npar);
-  layer3->gradient(J.block(0, 
-                           Npar - Npar3,
-                           layer3->GetOutSize(), 
-                           Npar3));
-  layer2->gradient(J.block(0, 
-                           Npar - Npar3 - Npar2,
-                           layer3->GetOutSize(), 
-                           Npar2));
-  layer1->gradient(J.block(0, 
-                           Npar - Npar3 - Npar2 - Npar1,
-                           layer3->GetOutSize(), 
-                           Npar1));
-
+  graph.backward();
+  const Eigen::MatrixXd& J = graph.jacobian();
 
   auto derivative = nn.Derive(x);
   std::cout << J.transpose() << std::endl;
@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef INCLUDE_THREAD_POOL
+#define INCLUDE_THREAD_POOL
+
+/**
+ * @brief Minimal pool of persistent worker threads
+ *
+ * @details The only operation is `parallel_for`, which splits a range of
+ *          indices in one contiguous chunk per worker and blocks until all
+ *          the chunks are done. The task is passed to the workers through
+ *          a function pointer and a pointer to the caller's functor, so no
+ *          allocation takes place when the pool is used.
+ */
+class ThreadPool
+{
+  public:
+    ThreadPool(size_t nthreads = std::max(1u, std::thread::hardware_concurrency()))
+    {
+      for (size_t i = 0; i < nthreads; i++)
+        workers_.emplace_back([this, i]() { work(i); });
+    }
+
+    ~ThreadPool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      wake_.notify_all();
+      for (auto& worker : workers_)
+        worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers_.size(); }
+
+    /**
+     * @brief Calls `func(worker, begin, end)` on a partition of [0, n)
+     *
+     * @details Worker `w` always gets the same chunk for the same `n`, so
+     *          per-worker state (e.g. a clone of a graph) can be indexed by `w`.
+     *
+     *          Calls from different threads are served one after the other.
+     *          A call from a worker of the pool itself, e.g. from `func`,
+     *          would wait for workers that are busy with the outer call, so
+     *          its chunks are run in order on the calling thread instead.
+     *          Per-worker state indexed by `w` is then shared with the
+     *          other workers of the outer call.
+     */
+    template <typename Func>
+    void parallel_for(size_t n, Func&& func)
+    {
+      const size_t nthreads = workers_.size();
+      const size_t chunk = (n + nthreads - 1) / nthreads;
+      auto task = [&func, n, chunk](size_t worker) {
+        const size_t begin = std::min(n, worker * chunk);
+        const size_t end = std::min(n, begin + chunk);
+        if (begin < end)
+          func(worker, begin, end);
+      };
+
+      if (current_ == this) {
+        for (size_t worker = 0; worker < nthreads; worker++)
+          task(worker);
+        return;
+      }
+
+      std::lock_guard<std::mutex> call(call_mutex_);
+      std::unique_lock<std::mutex> lock(mutex_);
+      context_ = &task;
+      invoke_ = [](void* context, size_t worker) { (*static_cast<decltype(task)*>(context))(worker); };
+      pending_ = nthreads;
+      generation_++;
+      wake_.notify_all();
+      done_.wait(lock, [this]() { return pending_ == 0; });
+    }
+
+  private:
+    void work(size_t worker)
+    {
+      current_ = this;
+      size_t seen = 0;
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          wake_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+          if (stop_)
+            return;
+          seen = generation_;
+        }
+        // The task is not modified until all the workers are done
+        invoke_(context_, worker);
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (--pending_ == 0)
+            done_.notify_one();
+        }
+      }
+    }
+
+    // Pool the calling thread is a worker of, if any
+    static inline thread_local const ThreadPool* current_ = nullptr;
+
+    std::vector<std::thread> workers_;
+    std::mutex call_mutex_; // held by the caller of `parallel_for`
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    void (*invoke_)(void*, size_t) = nullptr;
+    void* context_ = nullptr;
+    size_t pending_ = 0;
+    size_t generation_ = 0;
+    bool stop_ = false;
+};
+#endif
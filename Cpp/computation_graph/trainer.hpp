@@ -0,0 +1,89 @@
+#include "./computation_graph.hpp"
+#include "./thread_pool.hpp"
+#include "./sgd.hpp"
+#include "./adam.hpp"
+
+#ifndef INCLUDE_TRAINER
+#define INCLUDE_TRAINER
+
+/**
+ * @brief Training loop of a graph with a first-order optimizer
+ * 
+ * @tparam Optimizer updates the flat parameter buffer (see `SGD`, `Adam`)
+ * 
+ * @details Each `step` runs the forward pass on a batch, the vector-Jacobian
+ *          product of the residuals into the gradient arena (see `Graph::vjp`)
+ *          and the update of all the parameters in one sweep. The loss is
+ *          `|f(x) - y|^2 / (2 * batch)`, summed over the outputs.
+ * 
+ *          All the buffers of the graph and of the trainer are reused, so
+ *          once the first batch has been seen they are not allocated again as
+ *          long as the batch size does not change. The matrix products still
+ *          need blocking buffers, which Eigen takes from the stack up to
+ *          `EIGEN_STACK_ALLOCATION_LIMIT` (128 kB by default) and from the
+ *          heap above it, so with wide layers or large batches (e.g. 512
+ *          units and 512 samples) each step still allocates a few times.
+ *          With more than one thread the parameter update is split in
+ *          contiguous ranges over a pool of workers, which pays off only for
+ *          large models.
+ */
+template <typename Optimizer, typename P = typename Optimizer::PrecisionType>
+class TrainerTemplate
+{
+  public:
+    using Graph = GraphTemplate<P>;
+    using Matrix = typename P::Matrix;
+    using GradScalar = typename P::GradScalar;
+    using GradMatrix = typename P::GradMatrix;
+
+    TrainerTemplate(Graph& graph, const Optimizer& optimizer = Optimizer(), size_t nthreads = 1)
+    : graph_(graph),
+      optimizer_(optimizer),
+      pool_(nthreads > 1 ? std::make_unique<ThreadPool>(nthreads) : nullptr)
+    {
+      optimizer_.initialise(graph_.getParNumber());
+    }
+
+    /**
+     * @brief Performs one optimisation step on a batch
+     * 
+     * @param X contains the inputs, one column per sample
+     * @param Y contains the targets, one column per sample
+     * @return the loss before the update
+     */
+    GradScalar step(const Matrix& X, const Matrix& Y)
+    {
+      CG_TRACE_SCOPE("training step");
+      const GradScalar batch = X.cols();
+      graph_.GetInputNode()->CopyValues(X);
+      graph_.forward();
+      residuals_ = (graph_.GetOutput() - Y).template cast<GradScalar>() / batch;
+
+      graph_.ZeroGradients();
+      graph_.vjp(residuals_);
+
+      optimizer_.begin_step();
+      auto parameters = graph_.GetParameters();
+      auto gradients = graph_.GetGradients();
+      if (pool_)
+        pool_->parallel_for(parameters.size(), [&](size_t, size_t begin, size_t end) {
+          optimizer_.update(parameters, gradients, begin, end);
+        });
+      else
+        optimizer_.update(parameters, gradients, 0, parameters.size());
+
+      return batch * residuals_.squaredNorm() / 2;
+    }
+
+    Optimizer& GetOptimizer() { return optimizer_; }
+
+  private:
+    Graph& graph_;
+    Optimizer optimizer_;
+    std::unique_ptr<ThreadPool> pool_;
+    GradMatrix residuals_;
+};
+
+template <typename Optimizer>
+using Trainer = TrainerTemplate<Optimizer>;
+#endif
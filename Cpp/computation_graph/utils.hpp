@@ -1,3 +1,5 @@
+#include "./node.hpp"
+
 #ifndef INCLUDE_UTILS
 #define INCLUDE_UTILS
 
@@ -9,8 +11,33 @@ template <typename Func, typename Arg>
 concept Callable = requires(Func f, Arg arg) 
   { { f(arg) } -> std::same_as<Arg>; };
 
+// Activation classes that compute value and derivative in a single pass,
+// so that the derivative can be cached during the forward pass
+template <typename Func, typename Arg>
+concept FusedDerivative = requires(Func f, const Arg& arg, Arg& value, Arg& derivative)
+  { f.EvaluateAndDerive(arg, value, derivative); };
+
+// Activation classes that can write the value into an existing buffer,
+// without modifying their own state
+template <typename Func, typename Arg>
+concept InPlaceEvaluation = requires(const Func f, const Arg& arg, Arg& value)
+  { f.Evaluate(arg, value); };
+
+// Element-wise activations have a diagonal Jacobian, unless the policy
+// declares a different structure (e.g. the identity)
+template <typename ActivationPolicy>
+constexpr JacobianStructure activation_structure()
+{
+  if constexpr (requires { ActivationPolicy::jacobian_structure; })
+    return ActivationPolicy::jacobian_structure;
+  else
+    return JacobianStructure::Diagonal;
+}
+
 
 // Implementation details
+// Builds the dense `I ⊗ x^T` matrix element by element. It is not used by the
+// nodes anymore, but it is kept as a reference for the benchmarks.
 class recursive_functor {
   const Eigen::VectorXd& m_vec;
 public:
@@ -29,7 +56,7 @@ public:
 };
 
 
-Eigen::CwiseNullaryOp<recursive_functor, typename Eigen::MatrixXd>
+inline Eigen::CwiseNullaryOp<recursive_functor, typename Eigen::MatrixXd>
 makeRecursive(const Eigen::VectorXd& arg1, Eigen::Index rows, Eigen::Index cols)
 {
   return Eigen::MatrixXd::NullaryExpr(rows, cols, recursive_functor(arg1.derived()));
@@ -1,3 +1,5 @@
+#include "philox.hpp"
+#include "thread_pool.hpp"
 #include <random>
 #include <eigen3/Eigen/Eigen>
 #ifndef INCLUDE_UTILS_DISTRIBUTION
@@ -20,23 +22,71 @@ ReturnType unpack_tuple(RNG* g, const Tuple& t, std::index_sequence<Is...>)
 
 
 // The type of RNG is deduced from the argument list through template argument deduction!
-template <template<typename> typename distribution, typename RNG = std::mt19937, typename ...Args>
+// The distributions draw doubles, which are rounded to `Scalar`.
+template <template<typename> typename distribution, typename Scalar = double, typename RNG = std::mt19937, typename ...Args>
 requires std::uniform_random_bit_generator<RNG>
-Eigen::CwiseNullaryOp<distribution<RNG>, typename Eigen::MatrixXd>
+Eigen::CwiseNullaryOp<distribution<RNG>, Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>>
 RandomInit(size_t row, size_t col, RNG* g, const std::tuple<Args...>& tuple)
 {
-  return Eigen::MatrixXd::NullaryExpr(row, col, unpack_tuple<distribution<RNG>>(g, tuple, std::index_sequence_for<Args...>{}));
+  return Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::NullaryExpr(row, col, unpack_tuple<distribution<RNG>>(g, tuple, std::index_sequence_for<Args...>{}));
 }
 
 // TODO This function is specialises to eigen vectors. Maybe it is possible to use a unique
 // template for both functions.
-template <template<typename> typename distribution, typename RNG = std::mt19937, typename ...Args>
+template <template<typename> typename distribution, typename Scalar = double, typename RNG = std::mt19937, typename ...Args>
 requires std::uniform_random_bit_generator<RNG>
-Eigen::CwiseNullaryOp<distribution<RNG>, typename Eigen::VectorXd>
+Eigen::CwiseNullaryOp<distribution<RNG>, Eigen::Matrix<Scalar, Eigen::Dynamic, 1>>
 RandomInit(size_t col, RNG* g, const std::tuple<Args...>& tuple)
 {
-  return Eigen::VectorXd::NullaryExpr(col, unpack_tuple<distribution<RNG>>(g, tuple, std::index_sequence_for<Args...>{}));
+  return Eigen::Matrix<Scalar, Eigen::Dynamic, 1>::NullaryExpr(col, unpack_tuple<distribution<RNG>>(g, tuple, std::index_sequence_for<Args...>{}));
 }
 
 
-#endif
\ No newline at end of file
+// With a counter-based generator, element (i, j) is drawn from block
+// `first + i + j * row`, where `first` is the first block reserved for the
+// matrix. The numbers are the same as the elements would be drawn in
+// column-major order, but they can be evaluated in any order.
+template <template<typename> typename distribution, typename Scalar = double, typename RNG = std::mt19937, typename ...Args>
+requires CounterBasedRNG<RNG>
+auto RandomInit(size_t row, size_t col, RNG* g, const std::tuple<Args...>& tuple)
+{
+  const auto draw = unpack_tuple<distribution<RNG>>(g, tuple, std::index_sequence_for<Args...>{});
+  const uint64_t first = g->Reserve(row * col);
+  return Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::NullaryExpr(row, col, [draw, first, row](Eigen::Index i, Eigen::Index j) {
+    return Scalar(draw(first + i + j * row));
+  });
+}
+
+template <template<typename> typename distribution, typename Scalar = double, typename RNG = std::mt19937, typename ...Args>
+requires CounterBasedRNG<RNG>
+auto RandomInit(size_t col, RNG* g, const std::tuple<Args...>& tuple)
+{
+  const auto draw = unpack_tuple<distribution<RNG>>(g, tuple, std::index_sequence_for<Args...>{});
+  const uint64_t first = g->Reserve(col);
+  return Eigen::Matrix<Scalar, Eigen::Dynamic, 1>::NullaryExpr(col, [draw, first](Eigen::Index i) {
+    return Scalar(draw(first + i));
+  });
+}
+
+// Fills `mat` as `RandomInit` would, starting from block `first`, splitting
+// the elements among the workers of `pool` (serially if it is null). The
+// result does not depend on the number of workers.
+template <template<typename> typename distribution, typename RNG, typename Derived, typename ...Args>
+requires CounterBasedRNG<RNG>
+void RandomFill(const Eigen::DenseBase<Derived>& mat, uint64_t first, RNG* g, const std::tuple<Args...>& tuple, ThreadPool* pool = nullptr)
+{
+  using Scalar = typename Derived::Scalar;
+  Derived& out = const_cast<Eigen::DenseBase<Derived>&>(mat).derived();
+  const auto draw = unpack_tuple<distribution<RNG>>(g, tuple, std::index_sequence_for<Args...>{});
+  const Eigen::Index row = out.rows();
+  auto fill = [&](size_t, size_t begin, size_t end) {
+    for (size_t n = begin; n < end; n++)
+      out(Eigen::Index(n) % row, Eigen::Index(n) / row) = Scalar(draw(first + n));
+  };
+  if (pool)
+    pool->parallel_for(out.size(), fill);
+  else
+    fill(0, 0, out.size());
+}
+
+#endif
@@ -0,0 +1,65 @@
+#include "./node.hpp"
+#include <unordered_map>
+
+#ifndef INCLUDE_WORKSPACE
+#define INCLUDE_WORKSPACE
+
+/**
+ * @brief Execution state of an inference pass, separate from the model
+ *
+ * @details A graph holds the model, i.e. the nodes and their parameters,
+ *          and `Graph::evaluate` only reads it. Everything that changes
+ *          during the pass, i.e. the value of each node, lives in the
+ *          workspace. Each thread owns a workspace, and any number of them
+ *          can evaluate the same graph at the same time without locks, as
+ *          long as the parameters are not modified meanwhile.
+ *
+ *          The buffers are allocated when the workspace is created, for the
+ *          given batch size, so the passes do not allocate unless the batch
+ *          size changes. Gradients are not needed for inference, so there is
+ *          none.
+ *
+ *          A workspace is tied to the execution order of the graph it has
+ *          been created from (see `Graph::MakeWorkspace`), and it must be
+ *          created again if the graph is compiled again. The values of the
+ *          constant inputs are part of the model, and they are copied when
+ *          the workspace is created.
+ */
+template <typename P = DoublePrecision>
+class WorkspaceTemplate
+{
+  public:
+    using NodeType = NodeTemplate<P>;
+    using NodePtr = typename NodeType::NodePtr;
+    using Matrix = typename P::Matrix;
+
+    static constexpr size_t no_dependency = size_t(-1);
+
+    WorkspaceTemplate(const std::vector<NodePtr>& order, size_t batch = 1)
+    {
+      std::unordered_map<NodePtr, size_t> position;
+      for (size_t i = 0; i < order.size(); i++) {
+        position[order[i]] = i;
+        const auto dependencies = order[i]->GetDependencies();
+        dependency_.push_back(dependencies.empty() ? no_dependency : position.at(dependencies[0]));
+        if (order[i]->IsConstant())
+          values_.push_back(order[i]->GetValue());
+        else
+          values_.emplace_back(order[i]->GetOutSize(), batch);
+      }
+    }
+
+    // Value of the i-th node (in execution order) of the last pass
+    const Matrix& GetValue(size_t i) const { return values_[i]; }
+    const Matrix& GetOutput() const { return values_.back(); }
+
+  private:
+    template <typename>
+    friend class GraphTemplate;
+
+    std::vector<size_t> dependency_; // position of the dependency of each node
+    std::vector<Matrix> values_;
+};
+
+using Workspace = WorkspaceTemplate<>;
+#endif